@@ -0,0 +1,226 @@
+// Benchmarks for the hot paths of tesla-android-configuration-manager. The service is a
+// single translation unit, so it is compiled in here with its main() left out.
+#define TESLA_ANDROID_CONFIGURATION_MANAGER_NO_MAIN
+#include "tesla-android-configuration-manager.cpp"
+
+#include <filesystem>
+#include <fstream>
+
+#include <benchmark/benchmark.h>
+
+// A /sys/bus/usb/devices lookalike: root hubs, device_count devices and one interface
+// entry per device, which the scanners have to skip.
+class FakeUsbDevices {
+ public:
+  FakeUsbDevices(const char *name, int device_count, const char *extra_vendor_id, const char *extra_product_id) {
+    path_ = std::filesystem::temp_directory_path() / (std::string(name) + "-" + std::to_string(getpid()));
+    std::filesystem::create_directories(path_);
+    add_device("usb1", "1d6b", "0002");
+    add_device("usb2", "1d6b", "0003");
+    for (int i = 0; i < device_count; i++) {
+      char name[32], vendor_id[8], product_id[8];
+      snprintf(name, sizeof(name), "1-%d.%d", i / 8 + 1, i % 8 + 1);
+      snprintf(vendor_id, sizeof(vendor_id), "%04x", 0x0b00 + i);
+      snprintf(product_id, sizeof(product_id), "%04x", 0x1000 + i);
+      add_device(name, vendor_id, product_id);
+      std::filesystem::create_directories(path_ / (std::string(name) + ":1.0"));
+      std::ofstream(path_ / (std::string(name) + ":1.0") / "bInterfaceClass") << "ff\n";
+    }
+    if (extra_vendor_id != nullptr) add_device("2-1", extra_vendor_id, extra_product_id);
+  }
+
+  ~FakeUsbDevices() {
+    std::filesystem::remove_all(path_);
+  }
+
+  const char *path() const {
+    return path_.c_str();
+  }
+
+ private:
+  void add_device(const std::string &name, const char *vendor_id, const char *product_id) {
+    std::filesystem::create_directories(path_ / name);
+    std::ofstream(path_ / name / "idVendor") << vendor_id << "\n";
+    std::ofstream(path_ / name / "idProduct") << product_id << "\n";
+  }
+
+  std::filesystem::path path_;
+};
+
+const int FAKE_USB_DEVICE_COUNT = 64;
+
+const FakeUsbDevices &fake_usb_devices_without_carplay() {
+  static FakeUsbDevices devices("usb-devices-without-carplay", FAKE_USB_DEVICE_COUNT, nullptr, nullptr);
+  return devices;
+}
+
+const FakeUsbDevices &fake_usb_devices_with_carplay() {
+  static FakeUsbDevices devices("usb-devices-with-carplay", FAKE_USB_DEVICE_COUNT, "1314", "1521");
+  return devices;
+}
+
+// The scanner this service used before match_usb_devices: one full pass per VID:PID,
+// building 256-byte paths and reading both ids through stdio.
+int legacy_is_usb_device_present(const char *usb_devices_path, const char *vendor_id, const char *product_id) {
+    DIR *dir;
+    struct dirent *entry;
+
+    dir = opendir(usb_devices_path);
+    if (!dir) {
+        return 0;
+    }
+
+    while ((entry = readdir(dir)) != NULL) {
+        char vendor_file_path[256];
+        char product_file_path[256];
+        char vid[5], pid[5];
+
+        snprintf(vendor_file_path, sizeof(vendor_file_path), "%s/%s/idVendor", usb_devices_path, entry->d_name);
+        snprintf(product_file_path, sizeof(product_file_path), "%s/%s/idProduct", usb_devices_path, entry->d_name);
+
+        FILE *vendor_file = fopen(vendor_file_path, "r");
+        FILE *product_file = fopen(product_file_path, "r");
+
+        if (!vendor_file || !product_file) {
+            if (vendor_file) fclose(vendor_file);
+            if (product_file) fclose(product_file);
+            continue;
+        }
+
+        if (fgets(vid, sizeof(vid), vendor_file) == NULL) vid[0] = 0;
+        if (fgets(pid, sizeof(pid), product_file) == NULL) pid[0] = 0;
+
+        fclose(vendor_file);
+        fclose(product_file);
+
+        vid[strcspn(vid, "\n")] = 0;
+        pid[strcspn(pid, "\n")] = 0;
+
+        if (strcmp(vid, vendor_id) == 0 && strcmp(pid, product_id) == 0) {
+            closedir(dir);
+            return 1;
+        }
+    }
+
+    closedir(dir);
+    return 0;
+}
+
+// The CarPlay check as it used to be written: one scan per VID:PID.
+void legacy_carplay_check(benchmark::State &state, const FakeUsbDevices &devices) {
+  for (auto _ : state) {
+    int is_detected = legacy_is_usb_device_present(devices.path(), "1314", "1520") || legacy_is_usb_device_present(devices.path(), "1314", "1521");
+    benchmark::DoNotOptimize(is_detected);
+  }
+}
+
+void carplay_check(benchmark::State &state, const FakeUsbDevices &devices) {
+  const UsbDevicePattern patterns[] = {{0x1314, 0x1520}, {0x1314, 0x1521}};
+  bool found[2];
+  for (auto _ : state) {
+    size_t matched = match_usb_devices(devices.path(), patterns, 2, found, true);
+    benchmark::DoNotOptimize(matched);
+  }
+}
+
+void BM_LegacyIsUsbDevicePresent_Absent(benchmark::State &state) {
+  legacy_carplay_check(state, fake_usb_devices_without_carplay());
+}
+BENCHMARK(BM_LegacyIsUsbDevicePresent_Absent);
+
+void BM_MatchUsbDevices_Absent(benchmark::State &state) {
+  carplay_check(state, fake_usb_devices_without_carplay());
+}
+BENCHMARK(BM_MatchUsbDevices_Absent);
+
+void BM_LegacyIsUsbDevicePresent_Present(benchmark::State &state) {
+  legacy_carplay_check(state, fake_usb_devices_with_carplay());
+}
+BENCHMARK(BM_LegacyIsUsbDevicePresent_Present);
+
+void BM_MatchUsbDevices_Present(benchmark::State &state) {
+  carplay_check(state, fake_usb_devices_with_carplay());
+}
+BENCHMARK(BM_MatchUsbDevices_Present);
+
+// Reading every managed property once, as a GET of the configuration used to: one
+// property_get per key.
+void BM_GetSystemProperty_PerKey(benchmark::State &state) {
+  char prop_values[MANAGED_PROPERTY_COUNT][PROPERTY_VALUE_MAX];
+  for (auto _ : state) {
+    for (size_t i = 0; i < MANAGED_PROPERTY_COUNT; i++) {
+      get_system_property(MANAGED_PROPERTY_KEYS[i], prop_values[i]);
+    }
+    benchmark::DoNotOptimize(prop_values);
+  }
+}
+BENCHMARK(BM_GetSystemProperty_PerKey);
+
+void BM_GetSystemProperties_Bulk(benchmark::State &state) {
+  char prop_values[MANAGED_PROPERTY_COUNT][PROPERTY_VALUE_MAX];
+  for (auto _ : state) {
+    get_system_properties(MANAGED_PROPERTY_KEYS.data(), MANAGED_PROPERTY_COUNT, prop_values);
+    benchmark::DoNotOptimize(prop_values);
+  }
+}
+BENCHMARK(BM_GetSystemProperties_Bulk);
+
+// What a request pays after a property write: a fresh snapshot of every managed property.
+void BM_GetPropertySnapshot_Rebuild(benchmark::State &state) {
+  for (auto _ : state) {
+    invalidate_property_snapshot();
+    benchmark::DoNotOptimize(get_property_snapshot());
+  }
+}
+BENCHMARK(BM_GetPropertySnapshot_Rebuild);
+
+// What a request pays while nothing changed.
+void BM_GetPropertySnapshot_Cached(benchmark::State &state) {
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(get_property_snapshot());
+  }
+}
+BENCHMARK(BM_GetPropertySnapshot_Cached);
+
+// Spawn latency of a trivial command. The argument is how many MiB the parent keeps
+// resident, since fork() copies the page tables for all of it. Measured in wall time, as the
+// caller mostly waits.
+void legacy_fork_exec_true() {
+  pid_t pid = fork();
+  int status;
+  if (pid == -1) {
+    perror("fork failed");
+    exit(-1);
+  } else if (pid == 0) {
+    execlp("true", "true", NULL);
+    perror("execlp failed");
+    _exit(-1);
+  }
+  waitpid(pid, &status, 0);
+}
+
+void BM_LegacyForkExec(benchmark::State &state) {
+  std::vector<char> resident(state.range(0) << 20, 1);
+  for (auto _ : state) {
+    legacy_fork_exec_true();
+  }
+}
+BENCHMARK(BM_LegacyForkExec)->Arg(0)->Arg(64)->UseRealTime();
+
+void BM_LegacySystem(benchmark::State &state) {
+  std::vector<char> resident(state.range(0) << 20, 1);
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(system("true"));
+  }
+}
+BENCHMARK(BM_LegacySystem)->Arg(0)->Arg(64)->UseRealTime();
+
+void BM_RunProcess(benchmark::State &state) {
+  std::vector<char> resident(state.range(0) << 20, 1);
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(run_process({"true"}));
+  }
+}
+BENCHMARK(BM_RunProcess)->Arg(0)->Arg(64)->UseRealTime();
+
+BENCHMARK_MAIN();
@@ -1,8 +1,25 @@
 #include <sstream>
 #include <cstdlib>
+#include <cctype>
+#include <cerrno>
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
 #include <httplib.h>
 #include <cJSON.h>
 #include <cutils/properties.h>
+#include <sys/system_properties.h>
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <unistd.h>
@@ -10,39 +27,54 @@
 #include <stdlib.h>
 #include <string.h>
 #include <dirent.h>
+#include <fcntl.h>
+#include <limits.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <net/if.h>
 #include <sys/ioctl.h>
-
-const char *BAND_TYPE_SYSTEM_PROPERTY_KEY = "persist.tesla-android.softap.band_type";
-const char *CHANNEL_SYSTEM_PROPERTY_KEY = "persist.tesla-android.softap.channel";
-const char *CHANNEL_WIDTH_SYSTEM_PROPERTY_KEY = "persist.tesla-android.softap.channel_width";
-const char *IS_ENABLED_SYSTEM_PROPERTY_KEY = "persist.tesla-android.softap.is_enabled";
-const char *OFFLINE_MODE_IS_ENABLED_SYSTEM_PROPERTY_KEY = "persist.tesla-android.offline-mode.is_enabled";
-const char *OFFLINE_MODE_TELEMETRY_IS_ENABLED_SYSTEM_PROPERTY_KEY = "persist.tesla-android.offline-mode.telemetry.is_enabled";
-const char *OFFLINE_MODE_TESLA_FIRMWARE_DOWNLOADS_IS_ENABLED_SYSTEM_PROPERTY_KEY = "persist.tesla-android.offline-mode.tesla-firmware-downloads";
-const char *VIRTUAL_DISPLAY_RESOLUTION_WIDTH_SYSTEM_PROPERTY_KEY = "persist.tesla-android.virtual-display.resolution.width";
-const char *VIRTUAL_DISPLAY_RESOLUTION_HEIGHT_SYSTEM_PROPERTY_KEY = "persist.tesla-android.virtual-display.resolution.height";
-const char *VIRTUAL_DISPLAY_DENSITY_SYSTEM_PROPERTY_KEY = "persist.tesla-android.virtual-display.density";
-const char *VIRTUAL_DISPLAY_RESOLUTION_PRESET_SYSTEM_PROPERTY_KEY = "persist.tesla-android.virtual-display.resolutionPreset";
-const char *VIRTUAL_DISPLAY_RENDERER_SYSTEM_PROPERTY_KEY = "persist.tesla-android.virtual-display.renderer";
-const char *VIRTUAL_DISPLAY_IS_RESPONSIVE_SYSTEM_PROPERTY_KEY = "persist.tesla-android.virtual-display.is_responsive";
-const char *VIRTUAL_DISPLAY_IS_H264_SYSTEM_PROPERTY_KEY = "persist.tesla-android.virtual-display.is_h264";
-const char *VIRTUAL_DISPLAY_REFRESH_RATE_SYSTEM_PROPERTY_KEY = "persist.tesla-android.virtual-display.refresh_rate";
-const char *VIRTUAL_DISPLAY_QUALITY_SYSTEM_PROPERTY_KEY = "persist.tesla-android.virtual-display.quality";
-const char *VIRTUAL_DISPLAY_IS_REAR_DISPLAY_ENABLED_SYSTEM_PROPERTY_KEY = "persist.tesla-android.virtual-display.is-rear-display-enabled";
-const char *VIRTUAL_DISPLAY_IS_REAR_DISPLAY_PRIORITISED_SYSTEM_PROPERTY_KEY = "persist.tesla-android.virtual-display.is-rear-display-prioritised";
-const char *HEADLESS_CONFIG_IS_ENABLED_PROPERTY_KEY = "persist.drm_hwc.headless.is_enabled";
-const char *HEADLESS_CONFIG_OVERRIDE_PROPERTY_KEY = "persist.drm_hwc.headless.config";
-const char *HEADLESS_CONFIG_LATCH_PROPERTY_KEY = "persist.drm_hwc.latch";
-const char *BROWSER_AUDIO_IS_ENABLED_SYSTEM_PROPERTY_KEY = "persist.tesla-android.browser_audio.is_enabled";
-const char *BROWSER_AUDIO_VOLUME_SYSTEM_PROPERTY_KEY = "persist.tesla-android.browser_audio.volume";
-const char *RELEASE_TYPE_SYSTEM_PROPERTY_KEY = "persist.tesla-android.releasetype";
-const char *OTA_URL_SYSTEM_PROPERTY_KEY = "persist.tesla-android.updater.uri";
-const char *GPS_IS_ENABLED_SYSTEM_PROPERTY_KEY = "persist.tesla-android.gps.is_active";
-const char *GPS_HARDWARE_IS_DETECTED_SYSTEM_PROPERTY_KEY = "persist.tesla-android.gps_hw.is_detected";
+#include <poll.h>
+#include <signal.h>
+#include <spawn.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <linux/if.h>
+
+constexpr const char *BAND_TYPE_SYSTEM_PROPERTY_KEY = "persist.tesla-android.softap.band_type";
+constexpr const char *CHANNEL_SYSTEM_PROPERTY_KEY = "persist.tesla-android.softap.channel";
+constexpr const char *CHANNEL_WIDTH_SYSTEM_PROPERTY_KEY = "persist.tesla-android.softap.channel_width";
+constexpr const char *IS_ENABLED_SYSTEM_PROPERTY_KEY = "persist.tesla-android.softap.is_enabled";
+constexpr const char *OFFLINE_MODE_IS_ENABLED_SYSTEM_PROPERTY_KEY = "persist.tesla-android.offline-mode.is_enabled";
+constexpr const char *OFFLINE_MODE_TELEMETRY_IS_ENABLED_SYSTEM_PROPERTY_KEY = "persist.tesla-android.offline-mode.telemetry.is_enabled";
+constexpr const char *OFFLINE_MODE_TESLA_FIRMWARE_DOWNLOADS_IS_ENABLED_SYSTEM_PROPERTY_KEY = "persist.tesla-android.offline-mode.tesla-firmware-downloads";
+constexpr const char *VIRTUAL_DISPLAY_RESOLUTION_WIDTH_SYSTEM_PROPERTY_KEY = "persist.tesla-android.virtual-display.resolution.width";
+constexpr const char *VIRTUAL_DISPLAY_RESOLUTION_HEIGHT_SYSTEM_PROPERTY_KEY = "persist.tesla-android.virtual-display.resolution.height";
+constexpr const char *VIRTUAL_DISPLAY_DENSITY_SYSTEM_PROPERTY_KEY = "persist.tesla-android.virtual-display.density";
+constexpr const char *VIRTUAL_DISPLAY_RESOLUTION_PRESET_SYSTEM_PROPERTY_KEY = "persist.tesla-android.virtual-display.resolutionPreset";
+constexpr const char *VIRTUAL_DISPLAY_RENDERER_SYSTEM_PROPERTY_KEY = "persist.tesla-android.virtual-display.renderer";
+constexpr const char *VIRTUAL_DISPLAY_IS_RESPONSIVE_SYSTEM_PROPERTY_KEY = "persist.tesla-android.virtual-display.is_responsive";
+constexpr const char *VIRTUAL_DISPLAY_IS_H264_SYSTEM_PROPERTY_KEY = "persist.tesla-android.virtual-display.is_h264";
+constexpr const char *VIRTUAL_DISPLAY_REFRESH_RATE_SYSTEM_PROPERTY_KEY = "persist.tesla-android.virtual-display.refresh_rate";
+constexpr const char *VIRTUAL_DISPLAY_QUALITY_SYSTEM_PROPERTY_KEY = "persist.tesla-android.virtual-display.quality";
+constexpr const char *VIRTUAL_DISPLAY_IS_REAR_DISPLAY_ENABLED_SYSTEM_PROPERTY_KEY = "persist.tesla-android.virtual-display.is-rear-display-enabled";
+constexpr const char *VIRTUAL_DISPLAY_IS_REAR_DISPLAY_PRIORITISED_SYSTEM_PROPERTY_KEY = "persist.tesla-android.virtual-display.is-rear-display-prioritised";
+constexpr const char *HEADLESS_CONFIG_IS_ENABLED_PROPERTY_KEY = "persist.drm_hwc.headless.is_enabled";
+constexpr const char *HEADLESS_CONFIG_OVERRIDE_PROPERTY_KEY = "persist.drm_hwc.headless.config";
+constexpr const char *HEADLESS_CONFIG_LATCH_PROPERTY_KEY = "persist.drm_hwc.latch";
+constexpr const char *BROWSER_AUDIO_IS_ENABLED_SYSTEM_PROPERTY_KEY = "persist.tesla-android.browser_audio.is_enabled";
+constexpr const char *BROWSER_AUDIO_VOLUME_SYSTEM_PROPERTY_KEY = "persist.tesla-android.browser_audio.volume";
+constexpr const char *RELEASE_TYPE_SYSTEM_PROPERTY_KEY = "persist.tesla-android.releasetype";
+constexpr const char *OTA_URL_SYSTEM_PROPERTY_KEY = "persist.tesla-android.updater.uri";
+constexpr const char *GPS_IS_ENABLED_SYSTEM_PROPERTY_KEY = "persist.tesla-android.gps.is_active";
+constexpr const char *GPS_HARDWARE_IS_DETECTED_SYSTEM_PROPERTY_KEY = "persist.tesla-android.gps_hw.is_detected";
+constexpr const char *THERMAL_SAMPLE_INTERVAL_SYSTEM_PROPERTY_KEY = "persist.tesla-android.thermal.sample_interval_ms";
+constexpr const char *THERMAL_GOVERNOR_IS_ENABLED_SYSTEM_PROPERTY_KEY = "persist.tesla-android.thermal_governor.is_enabled";
+constexpr const char *THERMAL_GOVERNOR_THROTTLE_TEMPERATURE_SYSTEM_PROPERTY_KEY = "persist.tesla-android.thermal_governor.throttle_temperature";
+constexpr const char *THERMAL_GOVERNOR_RESTORE_TEMPERATURE_SYSTEM_PROPERTY_KEY = "persist.tesla-android.thermal_governor.restore_temperature";
+constexpr const char *THERMAL_GOVERNOR_USER_QUALITY_SYSTEM_PROPERTY_KEY = "persist.tesla-android.thermal_governor.user_quality";
+constexpr const char *THERMAL_GOVERNOR_USER_REFRESH_RATE_SYSTEM_PROPERTY_KEY = "persist.tesla-android.thermal_governor.user_refresh_rate";
+constexpr const char *VIRTUAL_DISPLAY_RECONFIGURE_DEBOUNCE_SYSTEM_PROPERTY_KEY = "persist.tesla-android.virtual-display.reconfigure_debounce_ms";
 
 int get_system_property_int(const char* prop_name) {
   char prop_value[PROPERTY_VALUE_MAX];
@@ -53,8 +85,8 @@ int get_system_property_int(const char* prop_name) {
   }
 }
 
-const char* get_system_property(const char* prop_name) {
-  static char prop_value[PROPERTY_VALUE_MAX];
+// Reentrant variant that reads into caller-owned storage.
+const char* get_system_property(const char* prop_name, char (&prop_value)[PROPERTY_VALUE_MAX]) {
   if (property_get(prop_name, prop_value, nullptr) > 0) {
     return prop_value;
   } else {
@@ -62,85 +94,467 @@ const char* get_system_property(const char* prop_name) {
   }
 }
 
-int is_usb_device_present(const char *vendor_id, const char *product_id) {
-    const char *usb_devices_path = "/sys/bus/usb/devices/";
-    DIR *dir;
-    struct dirent *entry;
+// The returned pointer stays valid until the calling thread reads another property.
+const char* get_system_property(const char* prop_name) {
+  static thread_local char prop_value[PROPERTY_VALUE_MAX];
+  return get_system_property(prop_name, prop_value);
+}
+
+enum PropertyType {
+  PROPERTY_TYPE_INT,
+  PROPERTY_TYPE_STRING,
+};
+
+// Which GET document a property is serialized into.
+enum PropertyGroup {
+  PROPERTY_GROUP_NONE,
+  PROPERTY_GROUP_CONFIGURATION,
+  PROPERTY_GROUP_DISPLAY_STATE,
+};
+
+struct PropertySchema {
+  const char* key;
+  PropertyGroup group;
+  const char* field;
+  // Route of the single-value POST setter, or nullptr when there is none.
+  const char* route;
+  PropertyType type;
+  int min_value;
+  int max_value;
+  // Accepted as part of POST /api/displayState.
+  bool is_display_setting;
+};
+
+// Every property this service reads or writes, in the order the GET documents list them.
+// Serializers, setters, preflight handlers and validation are all driven by this table.
+constexpr PropertySchema PROPERTY_SCHEMA[] = {
+  {BAND_TYPE_SYSTEM_PROPERTY_KEY, PROPERTY_GROUP_CONFIGURATION, BAND_TYPE_SYSTEM_PROPERTY_KEY, "/api/softApBand", PROPERTY_TYPE_INT, 0, 15, false},
+  {CHANNEL_SYSTEM_PROPERTY_KEY, PROPERTY_GROUP_CONFIGURATION, CHANNEL_SYSTEM_PROPERTY_KEY, "/api/softApChannel", PROPERTY_TYPE_INT, 0, 233, false},
+  {CHANNEL_WIDTH_SYSTEM_PROPERTY_KEY, PROPERTY_GROUP_CONFIGURATION, CHANNEL_WIDTH_SYSTEM_PROPERTY_KEY, "/api/softApChannelWidth", PROPERTY_TYPE_INT, 0, 15, false},
+  {IS_ENABLED_SYSTEM_PROPERTY_KEY, PROPERTY_GROUP_CONFIGURATION, IS_ENABLED_SYSTEM_PROPERTY_KEY, "/api/softApState", PROPERTY_TYPE_INT, 0, 1, false},
+  {OFFLINE_MODE_IS_ENABLED_SYSTEM_PROPERTY_KEY, PROPERTY_GROUP_CONFIGURATION, OFFLINE_MODE_IS_ENABLED_SYSTEM_PROPERTY_KEY, "/api/offlineModeState", PROPERTY_TYPE_INT, 0, 1, false},
+  {OFFLINE_MODE_TELEMETRY_IS_ENABLED_SYSTEM_PROPERTY_KEY, PROPERTY_GROUP_CONFIGURATION, OFFLINE_MODE_TELEMETRY_IS_ENABLED_SYSTEM_PROPERTY_KEY, "/api/offlineModeTelemetryState", PROPERTY_TYPE_INT, 0, 1, false},
+  {OFFLINE_MODE_TESLA_FIRMWARE_DOWNLOADS_IS_ENABLED_SYSTEM_PROPERTY_KEY, PROPERTY_GROUP_CONFIGURATION, OFFLINE_MODE_TESLA_FIRMWARE_DOWNLOADS_IS_ENABLED_SYSTEM_PROPERTY_KEY, "/api/offlineModeTeslaFirmwareDownloads", PROPERTY_TYPE_INT, 0, 1, false},
+  {BROWSER_AUDIO_IS_ENABLED_SYSTEM_PROPERTY_KEY, PROPERTY_GROUP_CONFIGURATION, BROWSER_AUDIO_IS_ENABLED_SYSTEM_PROPERTY_KEY, "/api/browserAudioState", PROPERTY_TYPE_INT, 0, 1, false},
+  {BROWSER_AUDIO_VOLUME_SYSTEM_PROPERTY_KEY, PROPERTY_GROUP_CONFIGURATION, BROWSER_AUDIO_VOLUME_SYSTEM_PROPERTY_KEY, "/api/browserAudioVolume", PROPERTY_TYPE_INT, 0, 100, false},
+  {GPS_IS_ENABLED_SYSTEM_PROPERTY_KEY, PROPERTY_GROUP_CONFIGURATION, GPS_IS_ENABLED_SYSTEM_PROPERTY_KEY, "/api/gpsState", PROPERTY_TYPE_INT, 0, 1, false},
+  {GPS_HARDWARE_IS_DETECTED_SYSTEM_PROPERTY_KEY, PROPERTY_GROUP_CONFIGURATION, GPS_HARDWARE_IS_DETECTED_SYSTEM_PROPERTY_KEY, nullptr, PROPERTY_TYPE_INT, 0, 1, false},
+  {VIRTUAL_DISPLAY_RESOLUTION_WIDTH_SYSTEM_PROPERTY_KEY, PROPERTY_GROUP_DISPLAY_STATE, "width", nullptr, PROPERTY_TYPE_INT, 1, 7680, true},
+  {VIRTUAL_DISPLAY_RESOLUTION_HEIGHT_SYSTEM_PROPERTY_KEY, PROPERTY_GROUP_DISPLAY_STATE, "height", nullptr, PROPERTY_TYPE_INT, 1, 4320, true},
+  {VIRTUAL_DISPLAY_DENSITY_SYSTEM_PROPERTY_KEY, PROPERTY_GROUP_DISPLAY_STATE, "density", nullptr, PROPERTY_TYPE_INT, 1, 1000, true},
+  {VIRTUAL_DISPLAY_REFRESH_RATE_SYSTEM_PROPERTY_KEY, PROPERTY_GROUP_DISPLAY_STATE, "refreshRate", nullptr, PROPERTY_TYPE_INT, 1, 240, true},
+  {VIRTUAL_DISPLAY_QUALITY_SYSTEM_PROPERTY_KEY, PROPERTY_GROUP_DISPLAY_STATE, "quality", nullptr, PROPERTY_TYPE_INT, 1, 100, true},
+  {VIRTUAL_DISPLAY_RESOLUTION_PRESET_SYSTEM_PROPERTY_KEY, PROPERTY_GROUP_DISPLAY_STATE, "resolutionPreset", nullptr, PROPERTY_TYPE_INT, 0, 100, true},
+  {VIRTUAL_DISPLAY_RENDERER_SYSTEM_PROPERTY_KEY, PROPERTY_GROUP_DISPLAY_STATE, "renderer", nullptr, PROPERTY_TYPE_INT, 0, 15, true},
+  {VIRTUAL_DISPLAY_IS_RESPONSIVE_SYSTEM_PROPERTY_KEY, PROPERTY_GROUP_DISPLAY_STATE, "isResponsive", nullptr, PROPERTY_TYPE_INT, 0, 1, true},
+  {VIRTUAL_DISPLAY_IS_H264_SYSTEM_PROPERTY_KEY, PROPERTY_GROUP_DISPLAY_STATE, "isH264", nullptr, PROPERTY_TYPE_INT, 0, 1, true},
+  {HEADLESS_CONFIG_IS_ENABLED_PROPERTY_KEY, PROPERTY_GROUP_DISPLAY_STATE, "isHeadless", nullptr, PROPERTY_TYPE_INT, 0, 1, false},
+  {VIRTUAL_DISPLAY_IS_REAR_DISPLAY_ENABLED_SYSTEM_PROPERTY_KEY, PROPERTY_GROUP_DISPLAY_STATE, "isRearDisplayEnabled", nullptr, PROPERTY_TYPE_INT, 0, 1, true},
+  {VIRTUAL_DISPLAY_IS_REAR_DISPLAY_PRIORITISED_SYSTEM_PROPERTY_KEY, PROPERTY_GROUP_DISPLAY_STATE, "isRearDisplayPrioritised", nullptr, PROPERTY_TYPE_INT, 0, 1, true},
+  {HEADLESS_CONFIG_OVERRIDE_PROPERTY_KEY, PROPERTY_GROUP_NONE, nullptr, nullptr, PROPERTY_TYPE_STRING, 0, 0, false},
+  {RELEASE_TYPE_SYSTEM_PROPERTY_KEY, PROPERTY_GROUP_NONE, nullptr, "/api/overrideReleaseType", PROPERTY_TYPE_STRING, 0, 0, false},
+  {OTA_URL_SYSTEM_PROPERTY_KEY, PROPERTY_GROUP_NONE, nullptr, "/api/overrideOtaUrl", PROPERTY_TYPE_STRING, 0, 0, false},
+  {THERMAL_SAMPLE_INTERVAL_SYSTEM_PROPERTY_KEY, PROPERTY_GROUP_NONE, nullptr, "/api/thermalSampleInterval", PROPERTY_TYPE_INT, 100, 60000, false},
+  {THERMAL_GOVERNOR_IS_ENABLED_SYSTEM_PROPERTY_KEY, PROPERTY_GROUP_NONE, nullptr, "/api/thermalGovernorState", PROPERTY_TYPE_INT, 0, 1, false},
+  {THERMAL_GOVERNOR_THROTTLE_TEMPERATURE_SYSTEM_PROPERTY_KEY, PROPERTY_GROUP_NONE, nullptr, "/api/thermalGovernorThrottleTemperature", PROPERTY_TYPE_INT, 40, 110, false},
+  {THERMAL_GOVERNOR_RESTORE_TEMPERATURE_SYSTEM_PROPERTY_KEY, PROPERTY_GROUP_NONE, nullptr, "/api/thermalGovernorRestoreTemperature", PROPERTY_TYPE_INT, 30, 105, false},
+  {THERMAL_GOVERNOR_USER_QUALITY_SYSTEM_PROPERTY_KEY, PROPERTY_GROUP_NONE, nullptr, nullptr, PROPERTY_TYPE_INT, 1, 100, false},
+  {THERMAL_GOVERNOR_USER_REFRESH_RATE_SYSTEM_PROPERTY_KEY, PROPERTY_GROUP_NONE, nullptr, nullptr, PROPERTY_TYPE_INT, 1, 240, false},
+  {VIRTUAL_DISPLAY_RECONFIGURE_DEBOUNCE_SYSTEM_PROPERTY_KEY, PROPERTY_GROUP_NONE, nullptr, "/api/displayReconfigureDebounce", PROPERTY_TYPE_INT, 0, 10000, false},
+};
+constexpr size_t MANAGED_PROPERTY_COUNT = sizeof(PROPERTY_SCHEMA) / sizeof(PROPERTY_SCHEMA[0]);
+
+constexpr bool is_same_string(const char* a, const char* b) {
+  return *a == *b && (*a == '\0' || is_same_string(a + 1, b + 1));
+}
 
-    dir = opendir(usb_devices_path);
-    if (!dir) {
-        perror("Could not open /sys/bus/usb/devices");
-        exit(EXIT_FAILURE);
+constexpr bool is_valid_property_schema() {
+  for (size_t i = 0; i < MANAGED_PROPERTY_COUNT; i++) {
+    const PropertySchema& schema = PROPERTY_SCHEMA[i];
+    if (schema.min_value > schema.max_value) return false;
+    if ((schema.group != PROPERTY_GROUP_NONE) != (schema.field != nullptr)) return false;
+    if (schema.is_display_setting && schema.group != PROPERTY_GROUP_DISPLAY_STATE) return false;
+    for (size_t j = i + 1; j < MANAGED_PROPERTY_COUNT; j++) {
+      if (is_same_string(schema.key, PROPERTY_SCHEMA[j].key)) return false;
+      if (schema.route != nullptr && PROPERTY_SCHEMA[j].route != nullptr && is_same_string(schema.route, PROPERTY_SCHEMA[j].route)) return false;
     }
+  }
+  return true;
+}
+static_assert(is_valid_property_schema(), "PROPERTY_SCHEMA has a duplicate key or route, or an invalid entry");
 
-    while ((entry = readdir(dir)) != NULL) {
-        char vendor_file_path[256];
-        char product_file_path[256];
-        char vid[5], pid[5];
+template <size_t... I>
+constexpr std::array<const char*, sizeof...(I)> property_schema_keys(std::index_sequence<I...>) {
+  return {{PROPERTY_SCHEMA[I].key...}};
+}
+constexpr std::array<const char*, MANAGED_PROPERTY_COUNT> MANAGED_PROPERTY_KEYS = property_schema_keys(std::make_index_sequence<MANAGED_PROPERTY_COUNT>());
 
-        snprintf(vendor_file_path, sizeof(vendor_file_path), "%s%s/idVendor", usb_devices_path, entry->d_name);
-        snprintf(product_file_path, sizeof(product_file_path), "%s%s/idProduct", usb_devices_path, entry->d_name);
+int managed_property_index(const char* prop_name) {
+  for (size_t i = 0; i < MANAGED_PROPERTY_COUNT; i++) {
+    if (MANAGED_PROPERTY_KEYS[i] == prop_name) return i;
+  }
+  for (size_t i = 0; i < MANAGED_PROPERTY_COUNT; i++) {
+    if (strcmp(MANAGED_PROPERTY_KEYS[i], prop_name) == 0) return i;
+  }
+  return -1;
+}
 
-        FILE *vendor_file = fopen(vendor_file_path, "r");
-        FILE *product_file = fopen(product_file_path, "r");
+// prop_info handles never move once a property exists, so they are resolved once and reused.
+// Keys that are not set yet are looked up again on each read; __system_property_find is a
+// trie lookup, far cheaper than walking the whole property area.
+static std::atomic<const prop_info*> managed_property_handles[MANAGED_PROPERTY_COUNT];
 
-        if (!vendor_file || !product_file) {
-            if (vendor_file) fclose(vendor_file);
-            if (product_file) fclose(product_file);
-            continue;
-        }
+const prop_info* find_managed_property_handle(int index) {
+  const prop_info* handle = managed_property_handles[index].load(std::memory_order_acquire);
+  if (handle == nullptr) {
+    handle = __system_property_find(MANAGED_PROPERTY_KEYS[index]);
+    if (handle != nullptr) managed_property_handles[index].store(handle, std::memory_order_release);
+  }
+  return handle;
+}
+
+void copy_property_value(void* cookie, const char* name, const char* value, uint32_t serial) {
+  snprintf(static_cast<char*>(cookie), PROPERTY_VALUE_MAX, "%s", value);
+}
+
+// Bulk counterpart of get_system_property. Fills prop_values[i] for each of prop_names,
+// leaving an empty string for properties that are not set.
+void get_system_properties(const char* const* prop_names, size_t count, char (*prop_values)[PROPERTY_VALUE_MAX]) {
+  for (size_t i = 0; i < count; i++) {
+    int index = managed_property_index(prop_names[i]);
+    const prop_info* handle = index >= 0 ? find_managed_property_handle(index) : __system_property_find(prop_names[i]);
+    prop_values[i][0] = '\0';
+    if (handle != nullptr) {
+      __system_property_read_callback(handle, copy_property_value, prop_values[i]);
+    }
+  }
+}
+
+struct PropertySnapshot {
+  uint32_t serial;
+  // Bumped only when a managed value differs from the previous snapshot.
+  uint64_t version;
+  char values[MANAGED_PROPERTY_COUNT][PROPERTY_VALUE_MAX];
+
+  const char* get(const char* prop_name) const {
+    int index = managed_property_index(prop_name);
+    return index >= 0 && values[index][0] != '\0' ? values[index] : nullptr;
+  }
+
+  int get_int(const char* prop_name) const {
+    const char* value = get(prop_name);
+    return value != nullptr ? atoi(value) : -1;
+  }
+};
+
+static std::shared_ptr<const PropertySnapshot> property_snapshot;
+static std::atomic<bool> property_snapshot_is_stale(true);
+static std::mutex property_snapshot_mutex;
+
+void invalidate_property_snapshot() {
+  property_snapshot_is_stale.store(true, std::memory_order_release);
+}
+
+// Returns the cached values of all managed properties. The snapshot is only rebuilt
+// when the property area serial moves or this service has written a property since.
+std::shared_ptr<const PropertySnapshot> get_property_snapshot() {
+  std::shared_ptr<const PropertySnapshot> snapshot = std::atomic_load(&property_snapshot);
+  if (snapshot != nullptr && !property_snapshot_is_stale.load(std::memory_order_acquire) &&
+      snapshot->serial == __system_property_area_serial()) {
+    return snapshot;
+  }
+
+  std::lock_guard<std::mutex> lock(property_snapshot_mutex);
+  snapshot = std::atomic_load(&property_snapshot);
+  if (snapshot != nullptr && !property_snapshot_is_stale.load(std::memory_order_acquire) &&
+      snapshot->serial == __system_property_area_serial()) {
+    return snapshot;
+  }
+
+  // Clear the flag and sample the serial before reading, so a concurrent write
+  // is either picked up here or forces the next caller to rebuild again.
+  property_snapshot_is_stale.store(false, std::memory_order_release);
+  std::shared_ptr<PropertySnapshot> fresh = std::make_shared<PropertySnapshot>();
+  fresh->serial = __system_property_area_serial();
+  get_system_properties(MANAGED_PROPERTY_KEYS.data(), MANAGED_PROPERTY_COUNT, fresh->values);
+
+  fresh->version = snapshot != nullptr ? snapshot->version : 1;
+  for (size_t i = 0; snapshot != nullptr && i < MANAGED_PROPERTY_COUNT; i++) {
+    if (strcmp(fresh->values[i], snapshot->values[i]) != 0) {
+      fresh->version++;
+      break;
+    }
+  }
+
+  snapshot = fresh;
+  std::atomic_store(&property_snapshot, snapshot);
+  return snapshot;
+}
+
+int set_system_property(const char* prop_name, const char* prop_value) {
+  int result = property_set(prop_name, prop_value);
+  invalidate_property_snapshot();
+  return result;
+}
+
+static std::atomic<uint64_t> property_writes_applied(0);
+static std::atomic<uint64_t> property_writes_skipped(0);
+
+// Persistent properties are rewritten to flash on every set, so values that would not
+// change are skipped and counted instead.
+int set_system_property_if_changed(const char* prop_name, const char* prop_value) {
+  char current_value[1][PROPERTY_VALUE_MAX];
+  get_system_properties(&prop_name, 1, current_value);
+  if (strcmp(current_value[0], prop_value) == 0) {
+    property_writes_skipped.fetch_add(1, std::memory_order_relaxed);
+    return 0;
+  }
+  property_writes_applied.fetch_add(1, std::memory_order_relaxed);
+  return set_system_property(prop_name, prop_value);
+}
+
+// Serializes batches, including single-key setters, so a rollback never overwrites a concurrent write.
+static std::mutex property_write_batch_mutex;
+
+// Collects several property writes and applies them as a unit. Nothing is written
+// unless every value is valid, and a failed write restores the values it replaced.
+struct PropertyWriteBatch {
+  std::vector<const char*> prop_names;
+  std::vector<std::string> prop_values;
+
+  void set(const char* prop_name, const std::string& prop_value) {
+    prop_names.push_back(prop_name);
+    prop_values.push_back(prop_value);
+  }
+
+  void set(const char* prop_name, int prop_value) {
+    set(prop_name, std::to_string(prop_value));
+  }
 
-        fgets(vid, sizeof(vid), vendor_file);
-        fgets(pid, sizeof(pid), product_file);
+  bool is_valid() const {
+    for (const std::string& prop_value : prop_values) {
+      if (prop_value.size() >= PROPERTY_VALUE_MAX) return false;
+    }
+    return true;
+  }
+
+  bool commit() {
+    if (!is_valid()) {
+      return false;
+    }
+
+    std::lock_guard<std::mutex> lock(property_write_batch_mutex);
+    std::unique_ptr<char[][PROPERTY_VALUE_MAX]> previous_values(new char[prop_names.size()][PROPERTY_VALUE_MAX]);
+    get_system_properties(prop_names.data(), prop_names.size(), previous_values.get());
+
+    for (size_t i = 0; i < prop_names.size(); i++) {
+      if (set_system_property_if_changed(prop_names[i], prop_values[i].c_str()) != 0) {
+        fprintf(stderr, "Failed to set %s, rolling back %zu properties\n", prop_names[i], i);
+        for (size_t j = i + 1; j-- > 0;) {
+          set_system_property_if_changed(prop_names[j], previous_values[j]);
+        }
+        return false;
+      }
+    }
+    return true;
+  }
+};
+
+const char *USB_DEVICES_PATH = "/sys/bus/usb/devices";
+
+struct UsbDevicePattern {
+    unsigned int vendor_id;
+    unsigned int product_id;
+};
+
+// Reads a 4-digit hex sysfs attribute such as idVendor relative to the devices directory.
+bool read_usb_id_at(int dirfd, const char *device_name, const char *attribute, unsigned int *value) {
+    char path[NAME_MAX + 16];
+    snprintf(path, sizeof(path), "%s/%s", device_name, attribute);
+    int fd = openat(dirfd, path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return false;
+
+    char buffer[8];
+    ssize_t length = read(fd, buffer, sizeof(buffer) - 1);
+    close(fd);
+    if (length <= 0) return false;
+
+    buffer[length] = '\0';
+    char *end;
+    *value = strtoul(buffer, &end, 16);
+    return end != buffer;
+}
 
-        fclose(vendor_file);
-        fclose(product_file);
+// Scans devices_path (normally USB_DEVICES_PATH) once for all patterns, setting found[i] for
+// each one present. Stops as soon as every pattern is resolved, or at the first match when
+// match_any is set.
+size_t match_usb_devices(const char *devices_path, const UsbDevicePattern *patterns, size_t count, bool *found, bool match_any) {
+    size_t matched = 0;
+    for (size_t i = 0; i < count; i++) found[i] = false;
+
+    DIR *dir = opendir(devices_path);
+    if (dir == nullptr) {
+        fprintf(stderr, "Could not open %s: %s\n", devices_path, strerror(errno));
+        return 0;
+    }
 
-        vid[strcspn(vid, "\n")] = 0;
-        pid[strcspn(pid, "\n")] = 0;
+    struct dirent *entry;
+    while (matched < count && (entry = readdir(dir)) != nullptr) {
+        unsigned int vendor_id, product_id;
+        if (entry->d_name[0] == '.' || strchr(entry->d_name, ':') != nullptr ||
+            !read_usb_id_at(dirfd(dir), entry->d_name, "idVendor", &vendor_id)) {
+            continue;
+        }
 
-        if (strcmp(vid, vendor_id) == 0 && strcmp(pid, product_id) == 0) {
-            closedir(dir);
-            return 1;
+        bool has_product_id = false;
+        for (size_t i = 0; i < count; i++) {
+            if (found[i] || patterns[i].vendor_id != vendor_id) continue;
+            if (!has_product_id && !read_usb_id_at(dirfd(dir), entry->d_name, "idProduct", &product_id)) break;
+            has_product_id = true;
+            if (patterns[i].product_id == product_id) {
+                found[i] = true;
+                matched++;
+            }
         }
+        if (match_any && matched > 0) break;
     }
 
     closedir(dir);
-    return 0;
+    return matched;
 }
 
-int is_port_open(const char *ip, int port) {
-    struct sockaddr_in address;
-    int sockfd, status;
-    struct timeval timeout;
+uint32_t usb_device_key(unsigned int vendor_id, unsigned int product_id) {
+    return (vendor_id << 16) | (product_id & 0xffff);
+}
 
-    timeout.tv_sec = 1;
-    timeout.tv_usec = 0;
+// Maps the devpath of every USB device (not interface) to its VID:PID, plus how many
+// devices carry each VID:PID. Seeded from sysfs and kept current from kernel uevents.
+static std::mutex usb_devices_mutex;
+static std::unordered_map<std::string, uint32_t> usb_devices_by_path;
+static std::unordered_map<uint32_t, int> usb_device_counts;
+static std::atomic<bool> usb_devices_tracked(false);
+
+// Returns true if the device was not indexed yet.
+bool add_usb_device(const std::string &devpath, uint32_t key) {
+    std::lock_guard<std::mutex> lock(usb_devices_mutex);
+    std::unordered_map<std::string, uint32_t>::iterator existing = usb_devices_by_path.find(devpath);
+    if (existing != usb_devices_by_path.end()) {
+        if (existing->second == key) return false;
+        usb_device_counts[existing->second]--;
+    }
+    usb_devices_by_path[devpath] = key;
+    usb_device_counts[key]++;
+    return true;
+}
 
-    sockfd = socket(AF_INET, SOCK_STREAM, 0);
-    if (sockfd < 0) {
-        perror("Socket creation failed");
-        exit(EXIT_FAILURE);
+bool remove_usb_device(const std::string &devpath) {
+    std::lock_guard<std::mutex> lock(usb_devices_mutex);
+    std::unordered_map<std::string, uint32_t>::iterator existing = usb_devices_by_path.find(devpath);
+    if (existing == usb_devices_by_path.end()) return false;
+    if (--usb_device_counts[existing->second] == 0) {
+        usb_device_counts.erase(existing->second);
+    }
+    usb_devices_by_path.erase(existing);
+    return true;
+}
+
+int is_any_usb_device_present(const UsbDevicePattern *patterns, size_t count) {
+    if (!usb_devices_tracked.load(std::memory_order_acquire)) {
+        std::unique_ptr<bool[]> found(new bool[count]);
+        return match_usb_devices(USB_DEVICES_PATH, patterns, count, found.get(), true) > 0;
     }
 
-    setsockopt(sockfd, SOL_SOCKET, SO_RCVTIMEO, (char *)&timeout, sizeof(timeout));
-    setsockopt(sockfd, SOL_SOCKET, SO_SNDTIMEO, (char *)&timeout, sizeof(timeout));
+    std::lock_guard<std::mutex> lock(usb_devices_mutex);
+    for (size_t i = 0; i < count; i++) {
+        if (usb_device_counts.count(usb_device_key(patterns[i].vendor_id, patterns[i].product_id)) > 0) return 1;
+    }
+    return 0;
+}
 
-    address.sin_family = AF_INET;
-    address.sin_port = htons(port);
-    inet_pton(AF_INET, ip, &address.sin_addr);
+struct PortProbeTarget {
+    const char *ip;
+    int port;
+};
+
+// Starts a non-blocking connect to every target at once and waits on all of them with a
+// shared deadline. Returns 1 as soon as any connection is established.
+int is_any_port_open(const PortProbeTarget *targets, size_t count, int timeout_ms) {
+    std::vector<struct pollfd> fds;
+    int result = 0;
+
+    for (size_t i = 0; i < count && !result; i++) {
+        int sockfd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (sockfd < 0) {
+            perror("Socket creation failed");
+            continue;
+        }
 
-    status = connect(sockfd, (struct sockaddr *)&address, sizeof(address));
-    close(sockfd);
+        struct sockaddr_in address;
+        memset(&address, 0, sizeof(address));
+        address.sin_family = AF_INET;
+        address.sin_port = htons(targets[i].port);
+        if (inet_pton(AF_INET, targets[i].ip, &address.sin_addr) != 1) {
+            close(sockfd);
+            continue;
+        }
+
+        if (connect(sockfd, (struct sockaddr *)&address, sizeof(address)) == 0) {
+            result = 1;
+        } else if (errno == EINPROGRESS) {
+            fds.push_back({sockfd, POLLOUT, 0});
+            continue;
+        }
+        close(sockfd);
+    }
+
+    std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+    while (!result && !fds.empty()) {
+        int remaining_ms = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now()).count();
+        if (remaining_ms <= 0) break;
+
+        int ready = poll(fds.data(), fds.size(), remaining_ms);
+        if (ready < 0 && errno == EINTR) continue;
+        if (ready <= 0) break;
+
+        for (size_t i = fds.size(); i-- > 0;) {
+            if (fds[i].revents == 0) continue;
+            int error = 0;
+            socklen_t length = sizeof(error);
+            if (getsockopt(fds[i].fd, SOL_SOCKET, SO_ERROR, &error, &length) == 0 && error == 0) {
+                result = 1;
+            }
+            close(fds[i].fd);
+            fds.erase(fds.begin() + i);
+        }
+    }
 
-    return status == 0;
+    for (const struct pollfd &pfd : fds) {
+        close(pfd.fd);
+    }
+    return result;
 }
 
+struct NetworkInterface {
+    int index;
+    unsigned int flags;
+    uint8_t operstate;
+};
+
+// Kept current by the rtnetlink listener in track_network_interfaces().
+static std::mutex network_interfaces_mutex;
+static std::unordered_map<std::string, NetworkInterface> network_interfaces;
+static std::atomic<bool> network_interfaces_tracked(false);
+
 int does_interface_exist(const char *interface_name) {
+    if (network_interfaces_tracked.load(std::memory_order_acquire)) {
+        std::lock_guard<std::mutex> lock(network_interfaces_mutex);
+        return network_interfaces.count(interface_name) > 0;
+    }
+
     int sockfd = socket(AF_INET, SOCK_DGRAM, 0);
     if (sockfd < 0) {
         perror("Socket creation failed");
-        exit(EXIT_FAILURE);
+        return 0;
     }
 
     struct ifreq ifr;
@@ -164,165 +578,1869 @@ void handle_preflight(httplib::Response& res) {
   res.status = 204;
 }
 
-void handle_error(httplib::Response& res) {
-  res.status = 500;
-  res.set_content("Internal Server Error", "text/plain");
+void handle_bad_request(httplib::Response& res) {
+  res.status = 400;
+  res.set_content("Bad Request", "text/plain");
+}
+
+void handle_error(httplib::Response& res) {
+  res.status = 500;
+  res.set_content("Internal Server Error", "text/plain");
+}
+
+void handle_service_unavailable(httplib::Response& res) {
+  res.status = 503;
+  res.set_header("Retry-After", "5");
+  res.set_content("Service Unavailable", "text/plain");
+}
+
+void add_string_property(cJSON* json, const char* prop_name, const char* prop_value, httplib::Response& res) {
+  if (prop_value == NULL) {
+    handle_error(res);
+    return;
+  }
+  cJSON_AddStringToObject(json, prop_name, prop_value);
+}
+
+void add_number_property(cJSON* json, const char* prop_name, int prop_value, httplib::Response& res) {
+  cJSON_AddNumberToObject(json, prop_name, prop_value);
+}
+
+// Fields named by a comma-separated `fields=` query parameter. Selects everything when empty.
+struct FieldSelector {
+  std::vector<std::string> fields;
+
+  bool includes(const char* field) const {
+    return fields.empty() || std::find(fields.begin(), fields.end(), field) != fields.end();
+  }
+};
+
+const FieldSelector ALL_FIELDS;
+
+FieldSelector parse_field_selector(const httplib::Request& req) {
+  FieldSelector selector;
+  if (!req.has_param("fields")) return selector;
+
+  std::stringstream fields(req.get_param_value("fields"));
+  std::string field;
+  while (std::getline(fields, field, ',')) {
+    field.erase(0, field.find_first_not_of(' '));
+    field.erase(field.find_last_not_of(' ') + 1);
+    if (!field.empty()) selector.fields.push_back(field);
+  }
+  return selector;
+}
+
+void add_property_group(cJSON* json, PropertyGroup group, const PropertySnapshot& snapshot, httplib::Response& res, const FieldSelector& selector) {
+  for (size_t i = 0; i < MANAGED_PROPERTY_COUNT; i++) {
+    if (PROPERTY_SCHEMA[i].group == group && selector.includes(PROPERTY_SCHEMA[i].field)) {
+      add_number_property(json, PROPERTY_SCHEMA[i].field, snapshot.get_int(PROPERTY_SCHEMA[i].key), res);
+    }
+  }
+}
+
+void add_configuration_properties(cJSON* json, const PropertySnapshot& snapshot, httplib::Response& res, const FieldSelector& selector = ALL_FIELDS) {
+  add_property_group(json, PROPERTY_GROUP_CONFIGURATION, snapshot, res, selector);
+}
+
+void add_display_state_properties(cJSON* json, const PropertySnapshot& snapshot, httplib::Response& res, const FieldSelector& selector = ALL_FIELDS) {
+  add_property_group(json, PROPERTY_GROUP_DISPLAY_STATE, snapshot, res, selector);
+}
+
+// Validates a raw value against its schema and writes the form that gets persisted.
+bool normalize_property_value(const PropertySchema& schema, const char* prop_value, std::string& normalized_value) {
+  if (schema.type == PROPERTY_TYPE_STRING) {
+    normalized_value = prop_value;
+    return normalized_value.size() < PROPERTY_VALUE_MAX;
+  }
+
+  char* end;
+  errno = 0;
+  long value = strtol(prop_value, &end, 10);
+  while (isspace(static_cast<unsigned char>(*end))) end++;
+  if (end == prop_value || *end != '\0' || errno != 0 || value < schema.min_value || value > schema.max_value) {
+    return false;
+  }
+  normalized_value = std::to_string(value);
+  return true;
+}
+
+// Finds a property that clients may set, by JSON field name or by property key.
+const PropertySchema* find_writable_property_schema(const char* name) {
+  for (const PropertySchema& schema : PROPERTY_SCHEMA) {
+    if (schema.route == nullptr && !schema.is_display_setting) continue;
+    if (strcmp(schema.key, name) == 0 || (schema.field != nullptr && strcmp(schema.field, name) == 0)) {
+      return &schema;
+    }
+  }
+  return nullptr;
+}
+
+void handle_property_post(const PropertySchema& schema, const httplib::Request& req, httplib::Response& res) {
+  std::string new_value;
+  if (!normalize_property_value(schema, req.body.c_str(), new_value)) {
+    handle_bad_request(res);
+    return;
+  }
+
+  PropertyWriteBatch batch;
+  batch.set(schema.key, new_value);
+  if (batch.commit()) {
+      handle_post_success(res);
+  } else {
+      handle_error(res);
+  }
+}
+
+// Blocks until the managed properties move past known_version or the timeout expires.
+// Waits on the property area serial, so nothing runs while no property changes.
+std::shared_ptr<const PropertySnapshot> wait_for_property_snapshot(uint64_t known_version, int timeout_ms) {
+  std::shared_ptr<const PropertySnapshot> snapshot = get_property_snapshot();
+  std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+
+  while (snapshot->version == known_version) {
+    std::chrono::nanoseconds remaining = deadline - std::chrono::steady_clock::now();
+    if (remaining.count() <= 0) break;
+
+    struct timespec timeout;
+    timeout.tv_sec = remaining.count() / 1000000000;
+    timeout.tv_nsec = remaining.count() % 1000000000;
+    uint32_t new_serial;
+    __system_property_wait(nullptr, snapshot->serial, &new_serial, &timeout);
+    snapshot = get_property_snapshot();
+  }
+  return snapshot;
+}
+
+uint32_t monotonic_clock_ms() {
+  return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+const int DEFAULT_PROCESS_TIMEOUT_MS = 10000;
+const size_t MAX_PROCESS_OUTPUT = 64 * 1024;
+// Reads allowed after exit. A full pipe (64 KiB by default) is emptied by 16 reads of 4 KiB.
+const int MAX_PROCESS_DRAIN_READS = 16;
+
+struct ProcessResult {
+  bool is_started = false;
+  bool is_timed_out = false;
+  int exit_status = -1;  // -1 unless the process exited normally
+  int signal = 0;        // set when the process was killed by a signal
+  std::string output;    // stdout
+  std::string error;     // stderr
+  int64_t duration_ms = 0;
+
+  bool is_success() const {
+    return exit_status == 0;
+  }
+};
+
+// Runs argv[0] (searched in PATH) without a shell and waits for it. posix_spawn() does
+// not copy the parent's page tables, which matters with the httplib worker threads running.
+// The process is killed once timeout_ms expires; output beyond MAX_PROCESS_OUTPUT is dropped.
+ProcessResult run_process(const std::vector<std::string>& args, int timeout_ms = DEFAULT_PROCESS_TIMEOUT_MS) {
+  ProcessResult result;
+  auto started_at = std::chrono::steady_clock::now();
+  auto deadline = started_at + std::chrono::milliseconds(timeout_ms);
+
+  std::vector<char*> argv;
+  for (const std::string& arg : args) {
+    argv.push_back(const_cast<char*>(arg.c_str()));
+  }
+  argv.push_back(nullptr);
+
+  int output_pipe[2], error_pipe[2];
+  if (pipe2(output_pipe, O_CLOEXEC) != 0) {
+    perror("pipe2 failed");
+    return result;
+  }
+  if (pipe2(error_pipe, O_CLOEXEC) != 0) {
+    perror("pipe2 failed");
+    close(output_pipe[0]);
+    close(output_pipe[1]);
+    return result;
+  }
+
+  posix_spawn_file_actions_t file_actions;
+  posix_spawn_file_actions_init(&file_actions);
+  posix_spawn_file_actions_addopen(&file_actions, STDIN_FILENO, "/dev/null", O_RDONLY, 0);
+  posix_spawn_file_actions_adddup2(&file_actions, output_pipe[1], STDOUT_FILENO);
+  posix_spawn_file_actions_adddup2(&file_actions, error_pipe[1], STDERR_FILENO);
+
+  // Threads may have signals blocked; the child should start with a clean mask.
+  posix_spawnattr_t attributes;
+  sigset_t signals;
+  sigemptyset(&signals);
+  posix_spawnattr_init(&attributes);
+  posix_spawnattr_setsigmask(&attributes, &signals);
+  posix_spawnattr_setflags(&attributes, POSIX_SPAWN_SETSIGMASK);
+
+  pid_t pid;
+  int spawn_error = posix_spawnp(&pid, argv[0], &file_actions, &attributes, argv.data(), environ);
+  posix_spawn_file_actions_destroy(&file_actions);
+  posix_spawnattr_destroy(&attributes);
+  close(output_pipe[1]);
+  close(error_pipe[1]);
+
+  if (spawn_error != 0) {
+    fprintf(stderr, "Could not run %s: %s\n", argv[0], strerror(spawn_error));
+    close(output_pipe[0]);
+    close(error_pipe[0]);
+    return result;
+  }
+  result.is_started = true;
+
+  struct pollfd fds[2] = {{output_pipe[0], POLLIN, 0}, {error_pipe[0], POLLIN, 0}};
+  std::string* buffers[2] = {&result.output, &result.error};
+  int open_count = 2;
+  int status = 0;
+  bool is_exited = false;
+  int exit_poll_us = 100;
+
+  auto read_ready_pipes = [&]() {
+    for (int i = 0; i < 2; i++) {
+      if (fds[i].fd < 0 || fds[i].revents == 0) continue;
+      char buffer[4096];
+      ssize_t length = read(fds[i].fd, buffer, sizeof(buffer));
+      if (length > 0) {
+        buffers[i]->append(buffer, std::min<size_t>(length, MAX_PROCESS_OUTPUT - std::min(buffers[i]->size(), MAX_PROCESS_OUTPUT)));
+      } else if (length == 0 || errno != EINTR) {
+        close(fds[i].fd);
+        fds[i].fd = -1;
+        open_count--;
+      }
+    }
+  };
+
+  // The exit is checked on every pass rather than after EOF, because a descendant (a
+  // daemon the command started) may keep the pipes open long after the command exited.
+  // Exit usually follows within a fraction of a millisecond, so the check backs off
+  // gradually instead of sleeping a fixed interval.
+  while (true) {
+    if (waitpid(pid, &status, WNOHANG) == pid) {
+      is_exited = true;
+      break;
+    }
+
+    int remaining_ms = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now()).count();
+    if (remaining_ms <= 0) {
+      result.is_timed_out = true;
+      break;
+    }
+
+    if (open_count == 0) {
+      std::this_thread::sleep_for(std::chrono::microseconds(std::min(remaining_ms * 1000, exit_poll_us)));
+    } else {
+      int ready = poll(fds, 2, std::min(remaining_ms, std::max(exit_poll_us / 1000, 1)));
+      if (ready < 0 && errno != EINTR) {
+        perror("poll failed");
+        break;
+      }
+      if (ready > 0) {
+        read_ready_pipes();
+        continue;
+      }
+    }
+    exit_poll_us = std::min(exit_poll_us * 2, 50000);
+  }
+
+  // Collect what the command wrote before it exited, without waiting for descendants. The
+  // reads are capped, so a descendant that keeps writing cannot hold the caller here.
+  for (int i = 0; is_exited && open_count > 0 && i < MAX_PROCESS_DRAIN_READS && poll(fds, 2, 0) > 0; i++) {
+    read_ready_pipes();
+  }
+
+  for (const struct pollfd& fd : fds) {
+    if (fd.fd >= 0) close(fd.fd);
+  }
+  if (!is_exited) {
+    kill(pid, SIGKILL);
+    while (waitpid(pid, &status, 0) < 0 && errno == EINTR) {}
+  }
+
+  if (WIFEXITED(status)) {
+    result.exit_status = WEXITSTATUS(status);
+  } else if (WIFSIGNALED(status)) {
+    result.signal = WTERMSIG(status);
+  }
+  result.duration_ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - started_at).count();
+  return result;
+}
+
+// Logs the outcome of a command, including its stderr when it failed.
+ProcessResult run_logged_process(const std::vector<std::string>& args, int timeout_ms = DEFAULT_PROCESS_TIMEOUT_MS) {
+  ProcessResult result = run_process(args, timeout_ms);
+  if (result.is_timed_out) {
+    printf("%s timed out after %d ms\n", args[0].c_str(), timeout_ms);
+  } else if (result.is_started) {
+    printf("%s exit status: %d\n", args[0].c_str(), result.exit_status);
+  }
+  if (!result.is_success() && !result.error.empty()) {
+    fprintf(stderr, "%s: %s", args[0].c_str(), result.error.c_str());
+  }
+  return result;
+}
+
+struct DisplayConfiguration {
+  int width;
+  int height;
+  int density;
+  int refresh_rate;
+};
+
+enum DisplayJobStatus {
+  DISPLAY_JOB_QUEUED,
+  DISPLAY_JOB_RUNNING,
+  DISPLAY_JOB_SUCCEEDED,
+  DISPLAY_JOB_FAILED,
+  DISPLAY_JOB_SUPERSEDED,
+};
+
+enum DisplayJobStepStatus {
+  DISPLAY_JOB_STEP_PENDING,
+  DISPLAY_JOB_STEP_RUNNING,
+  DISPLAY_JOB_STEP_SUCCEEDED,
+  DISPLAY_JOB_STEP_FAILED,
+  DISPLAY_JOB_STEP_SKIPPED,
+};
+
+const char* DISPLAY_JOB_STATUS_NAMES[] = {"queued", "running", "succeeded", "failed", "superseded"};
+const char* DISPLAY_JOB_STEP_STATUS_NAMES[] = {"pending", "running", "succeeded", "failed", "skipped"};
+
+enum DisplayJobStepIndex {
+  DISPLAY_JOB_STEP_WM_SIZE_RESET,
+  DISPLAY_JOB_STEP_WM_DENSITY,
+  DISPLAY_JOB_STEP_UNLOAD_TOUCHSCREEN,
+  DISPLAY_JOB_STEP_LOAD_TOUCHSCREEN,
+  DISPLAY_JOB_STEP_RESTART_VIRTUAL_DISPLAY,
+  DISPLAY_JOB_STEP_COUNT,
+};
+
+const char* DISPLAY_JOB_STEP_NAMES[DISPLAY_JOB_STEP_COUNT] = {
+  "wm_size_reset",
+  "wm_density",
+  "unload_touchscreen",
+  "load_touchscreen",
+  "restart_virtual_display",
+};
+
+enum DisplayField {
+  DISPLAY_FIELD_WIDTH = 1 << 0,
+  DISPLAY_FIELD_HEIGHT = 1 << 1,
+  DISPLAY_FIELD_DENSITY = 1 << 2,
+  DISPLAY_FIELD_REFRESH_RATE = 1 << 3,
+  DISPLAY_FIELD_ALL = (1 << 4) - 1,
+};
+
+const char* DISPLAY_FIELD_NAMES[] = {"width", "height", "density", "refreshRate"};
+
+// Fields each step depends on. A step only runs when one of them changed since the
+// configuration that was last applied. The headless config is WxH@refresh rate.
+const unsigned int DISPLAY_JOB_STEP_FIELDS[DISPLAY_JOB_STEP_COUNT] = {
+  DISPLAY_FIELD_WIDTH | DISPLAY_FIELD_HEIGHT,
+  DISPLAY_FIELD_DENSITY,
+  DISPLAY_FIELD_WIDTH | DISPLAY_FIELD_HEIGHT,
+  DISPLAY_FIELD_WIDTH | DISPLAY_FIELD_HEIGHT,
+  DISPLAY_FIELD_WIDTH | DISPLAY_FIELD_HEIGHT | DISPLAY_FIELD_REFRESH_RATE,
+};
+
+unsigned int get_changed_display_fields(const DisplayConfiguration& previous, const DisplayConfiguration& current) {
+  return (previous.width != current.width ? DISPLAY_FIELD_WIDTH : 0) |
+         (previous.height != current.height ? DISPLAY_FIELD_HEIGHT : 0) |
+         (previous.density != current.density ? DISPLAY_FIELD_DENSITY : 0) |
+         (previous.refresh_rate != current.refresh_rate ? DISPLAY_FIELD_REFRESH_RATE : 0);
+}
+
+struct DisplayJobStep {
+  DisplayJobStepStatus status = DISPLAY_JOB_STEP_PENDING;
+  int exit_status = -1;
+  int64_t duration_ms = 0;
+};
+
+// One run of configure_virtual_display. Fields other than id and configuration are
+// updated by the worker and guarded by display_job_mutex.
+struct DisplayJob {
+  uint64_t id;
+  DisplayConfiguration configuration;
+  DisplayJobStatus status = DISPLAY_JOB_QUEUED;
+  uint32_t queued_at_ms;
+  uint32_t started_at_ms = 0;
+  uint32_t finished_at_ms = 0;
+  uint64_t superseded_by = 0;
+  unsigned int changed_fields = DISPLAY_FIELD_ALL;  // planned by the worker when the job starts
+  DisplayJobStep steps[DISPLAY_JOB_STEP_COUNT];
+};
+
+const size_t DISPLAY_JOB_HISTORY_CAPACITY = 32;
+const int DEFAULT_DISPLAY_RECONFIGURE_DEBOUNCE_MS = 500;
+
+static std::mutex display_job_mutex;
+static std::condition_variable display_job_wakeup;
+static std::condition_variable display_reconciler_wakeup;
+// At most one job waits for the worker. A newer job replaces it, so a burst of changes
+// (a slider being dragged) is applied once, with the newest configuration.
+static std::shared_ptr<DisplayJob> pending_display_job;
+static bool is_display_job_running = false;
+// Most recent jobs, newest last, so clients can poll a job after it finished.
+static std::deque<std::shared_ptr<DisplayJob>> display_job_history;
+static uint64_t next_display_job_id = 1;
+// What the display was last successfully configured with. Only the fields in
+// applied_display_fields are known; the others (all of them before the first job, or a
+// field whose step failed) are always treated as changed.
+static DisplayConfiguration applied_display_configuration;
+static unsigned int applied_display_fields = 0;
+
+void set_display_job_step(DisplayJob& job, DisplayJobStepIndex step, DisplayJobStepStatus status, int exit_status = -1, int64_t duration_ms = 0) {
+  std::lock_guard<std::mutex> lock(display_job_mutex);
+  job.steps[step].status = status;
+  job.steps[step].exit_status = exit_status;
+  job.steps[step].duration_ms = duration_ms;
+}
+
+bool is_display_job_step_planned(const DisplayJob& job, DisplayJobStepIndex step) {
+  return (job.changed_fields & DISPLAY_JOB_STEP_FIELDS[step]) != 0;
+}
+
+bool run_display_job_step(DisplayJob& job, DisplayJobStepIndex step, const std::vector<std::string>& args) {
+  if (!is_display_job_step_planned(job, step)) {
+    set_display_job_step(job, step, DISPLAY_JOB_STEP_SKIPPED);
+    return true;
+  }
+  set_display_job_step(job, step, DISPLAY_JOB_STEP_RUNNING);
+  ProcessResult result = run_logged_process(args);
+  set_display_job_step(job, step, result.is_success() ? DISPLAY_JOB_STEP_SUCCEEDED : DISPLAY_JOB_STEP_FAILED, result.exit_status, result.duration_ms);
+  return result.is_success();
+}
+
+void configure_virtual_display(DisplayJob& job) {
+  const char* binaryPath = "/system/bin/wm";
+  const DisplayConfiguration& configuration = job.configuration;
+
+  std::ostringstream resolutionStream;
+  resolutionStream << configuration.width << "x" << configuration.height << "@" << configuration.refresh_rate;
+  std::string resolutionStr = resolutionStream.str();
+  const char* resolution = resolutionStr.c_str();
+
+  //Disable old overrides
+  run_display_job_step(job, DISPLAY_JOB_STEP_WM_SIZE_RESET, {binaryPath, "size", "reset"});
+
+  // Set density
+  run_display_job_step(job, DISPLAY_JOB_STEP_WM_DENSITY, {binaryPath, "density", std::to_string(configuration.density)});
+
+  // Unload virtual touchscreen module. It is not loaded yet on a cold boot, and rmmod
+  // failing there must not count against the job.
+  if (access("/sys/module/virtual_touchscreen", F_OK) != 0) {
+    set_display_job_step(job, DISPLAY_JOB_STEP_UNLOAD_TOUCHSCREEN, DISPLAY_JOB_STEP_SKIPPED);
+  } else {
+    run_display_job_step(job, DISPLAY_JOB_STEP_UNLOAD_TOUCHSCREEN, {"/vendor/bin/rmmod", "virtual_touchscreen"});
+  }
+
+  // Load virtual touchscreen
+  run_display_job_step(job, DISPLAY_JOB_STEP_LOAD_TOUCHSCREEN,
+                       {"/vendor/bin/modprobe", "-d", "/vendor/lib/modules", "-a", "virtual_touchscreen",
+                        "abs_x_max_param=" + std::to_string(configuration.width), "abs_y_max_param=" + std::to_string(configuration.height)});
+
+  // Check current headless resolution
+  char headlessOverrideValue[PROPERTY_VALUE_MAX];
+  if (get_system_property(HEADLESS_CONFIG_OVERRIDE_PROPERTY_KEY, headlessOverrideValue) == nullptr) {
+    headlessOverrideValue[0] = '\0';
+  }
+  int isHeadless = get_system_property_int(HEADLESS_CONFIG_IS_ENABLED_PROPERTY_KEY);
+  if (!is_display_job_step_planned(job, DISPLAY_JOB_STEP_RESTART_VIRTUAL_DISPLAY) || resolutionStr == headlessOverrideValue) {
+    printf("Headless override config unchanged");
+    set_display_job_step(job, DISPLAY_JOB_STEP_RESTART_VIRTUAL_DISPLAY, DISPLAY_JOB_STEP_SKIPPED);
+  } else if (isHeadless == 0) {
+    printf("Not in headless mode, resize not needed");
+    set_display_job_step(job, DISPLAY_JOB_STEP_RESTART_VIRTUAL_DISPLAY, DISPLAY_JOB_STEP_SKIPPED);
+  } else {
+    printf("Headless override config needs update, triggering the lath");
+    uint32_t started_at_ms = monotonic_clock_ms();
+    set_display_job_step(job, DISPLAY_JOB_STEP_RESTART_VIRTUAL_DISPLAY, DISPLAY_JOB_STEP_RUNNING);
+    ProcessResult stop_result = run_logged_process({"stop", "tesla-android-virtual-display"});
+    set_system_property(HEADLESS_CONFIG_OVERRIDE_PROPERTY_KEY, resolution);
+    set_system_property(HEADLESS_CONFIG_LATCH_PROPERTY_KEY, "1");
+    sleep(1);
+    ProcessResult start_result = run_logged_process({"start", "tesla-android-virtual-display"});
+    bool is_success = stop_result.is_success() && start_result.is_success();
+    set_display_job_step(job, DISPLAY_JOB_STEP_RESTART_VIRTUAL_DISPLAY, is_success ? DISPLAY_JOB_STEP_SUCCEEDED : DISPLAY_JOB_STEP_FAILED,
+                         is_success ? 0 : (stop_result.is_success() ? start_result : stop_result).exit_status,
+                         (uint32_t)(monotonic_clock_ms() - started_at_ms));
+  }
+}
+
+std::shared_ptr<DisplayJob> enqueue_display_job(const DisplayConfiguration& configuration) {
+  std::shared_ptr<DisplayJob> job = std::make_shared<DisplayJob>();
+  job->configuration = configuration;
+  job->queued_at_ms = monotonic_clock_ms();
+
+  std::lock_guard<std::mutex> lock(display_job_mutex);
+  job->id = next_display_job_id++;
+  if (pending_display_job != nullptr) {
+    pending_display_job->status = DISPLAY_JOB_SUPERSEDED;
+    pending_display_job->superseded_by = job->id;
+    pending_display_job->finished_at_ms = job->queued_at_ms;
+  }
+  pending_display_job = job;
+  display_job_history.push_back(job);
+  if (display_job_history.size() > DISPLAY_JOB_HISTORY_CAPACITY) {
+    display_job_history.pop_front();
+  }
+  display_job_wakeup.notify_one();
+  display_reconciler_wakeup.notify_one();
+  return job;
+}
+
+DisplayConfiguration get_display_configuration(const PropertySnapshot& snapshot) {
+  DisplayConfiguration configuration;
+  configuration.width = snapshot.get_int(VIRTUAL_DISPLAY_RESOLUTION_WIDTH_SYSTEM_PROPERTY_KEY);
+  configuration.height = snapshot.get_int(VIRTUAL_DISPLAY_RESOLUTION_HEIGHT_SYSTEM_PROPERTY_KEY);
+  configuration.density = snapshot.get_int(VIRTUAL_DISPLAY_DENSITY_SYSTEM_PROPERTY_KEY);
+  configuration.refresh_rate = snapshot.get_int(VIRTUAL_DISPLAY_REFRESH_RATE_SYSTEM_PROPERTY_KEY);
+  return configuration;
+}
+
+const int DISPLAY_RECONCILE_INTERVAL_MS = 1000;
+const int DISPLAY_RECONCILE_MIN_BACKOFF_MS = 1000;
+const int DISPLAY_RECONCILE_MAX_BACKOFF_MS = 300000;
+
+// Convergence and failure accounting of the reconciler, guarded by display_job_mutex.
+// The display is misconfigured from the moment desired and applied state differ until a
+// job makes them equal again.
+struct DisplayReconcilerState {
+  bool is_misconfigured = false;
+  uint32_t misconfigured_since_ms = 0;
+  unsigned int drifted_fields = 0;
+  uint64_t convergence_count = 0;
+  uint32_t last_convergence_ms = 0;
+  uint32_t max_convergence_ms = 0;
+  uint64_t total_misconfigured_ms = 0;
+  uint64_t attempt_count = 0;
+  uint64_t failure_count = 0;
+  int consecutive_failures = 0;
+  uint32_t next_attempt_at_ms = 0;
+};
+
+static DisplayReconcilerState display_reconciler_state;
+
+// Called by the worker with display_job_mutex held once a job has finished.
+void record_display_job_outcome(const DisplayJob& job) {
+  DisplayReconcilerState& state = display_reconciler_state;
+  if (job.status == DISPLAY_JOB_FAILED) {
+    state.failure_count++;
+    state.consecutive_failures++;
+    int backoff_ms = DISPLAY_RECONCILE_MAX_BACKOFF_MS;
+    if (state.consecutive_failures <= 20) {
+      backoff_ms = std::min(DISPLAY_RECONCILE_MIN_BACKOFF_MS << (state.consecutive_failures - 1), DISPLAY_RECONCILE_MAX_BACKOFF_MS);
+    }
+    state.next_attempt_at_ms = job.finished_at_ms + backoff_ms;
+  } else {
+    state.consecutive_failures = 0;
+    state.next_attempt_at_ms = job.finished_at_ms;
+  }
+  display_reconciler_wakeup.notify_one();
+}
+
+// Compares the desired persist.* state with what was applied and queues a job for the
+// drift, unless one is already queued or running or a failed attempt is backing off.
+// Returns how long the reconciler may sleep before the next comparison.
+int reconcile_display_configuration() {
+  DisplayConfiguration desired = get_display_configuration(*get_property_snapshot());
+  uint32_t now_ms = monotonic_clock_ms();
+
+  {
+    std::lock_guard<std::mutex> lock(display_job_mutex);
+    DisplayReconcilerState& state = display_reconciler_state;
+    state.drifted_fields = get_changed_display_fields(applied_display_configuration, desired) |
+                           (DISPLAY_FIELD_ALL & ~applied_display_fields);
+
+    if (state.drifted_fields == 0) {
+      if (state.is_misconfigured) {
+        state.is_misconfigured = false;
+        state.last_convergence_ms = now_ms - state.misconfigured_since_ms;
+        state.max_convergence_ms = std::max(state.max_convergence_ms, state.last_convergence_ms);
+        state.total_misconfigured_ms += state.last_convergence_ms;
+        state.convergence_count++;
+      }
+      return DISPLAY_RECONCILE_INTERVAL_MS;
+    }
+
+    if (!state.is_misconfigured) {
+      state.is_misconfigured = true;
+      state.misconfigured_since_ms = now_ms;
+    }
+    if (pending_display_job != nullptr || is_display_job_running) {
+      return DISPLAY_RECONCILE_INTERVAL_MS;
+    }
+    int backoff_remaining_ms = (int)(state.next_attempt_at_ms - now_ms);
+    if (backoff_remaining_ms > 0) {
+      return std::min(backoff_remaining_ms, DISPLAY_RECONCILE_INTERVAL_MS);
+    }
+    state.attempt_count++;
+  }
+
+  enqueue_display_job(desired);
+  return DISPLAY_RECONCILE_INTERVAL_MS;
+}
+
+void run_display_reconciler() {
+  while (true) {
+    int sleep_ms = reconcile_display_configuration();
+    std::unique_lock<std::mutex> lock(display_job_mutex);
+    display_reconciler_wakeup.wait_for(lock, std::chrono::milliseconds(sleep_ms));
+  }
+}
+
+// The first pass also applies the configuration at boot.
+void start_display_reconciler() {
+  std::thread(run_display_reconciler).detach();
+}
+
+// Fields outside the fields mask are reported as null.
+cJSON* add_display_configuration(cJSON* json, const char* name, const DisplayConfiguration& configuration, unsigned int fields = DISPLAY_FIELD_ALL) {
+  cJSON* configuration_json = cJSON_AddObjectToObject(json, name);
+  const int values[] = {configuration.width, configuration.height, configuration.density, configuration.refresh_rate};
+  for (size_t i = 0; i < sizeof(DISPLAY_FIELD_NAMES) / sizeof(DISPLAY_FIELD_NAMES[0]); i++) {
+    if (fields & (1 << i)) {
+      cJSON_AddNumberToObject(configuration_json, DISPLAY_FIELD_NAMES[i], values[i]);
+    } else {
+      cJSON_AddNullToObject(configuration_json, DISPLAY_FIELD_NAMES[i]);
+    }
+  }
+  return configuration_json;
+}
+
+cJSON* create_display_reconciler_state() {
+  DisplayConfiguration desired = get_display_configuration(*get_property_snapshot());
+  uint32_t now_ms = monotonic_clock_ms();
+
+  std::lock_guard<std::mutex> lock(display_job_mutex);
+  const DisplayReconcilerState& state = display_reconciler_state;
+  cJSON* json = cJSON_CreateObject();
+  cJSON_AddBoolToObject(json, "is_converged", !state.is_misconfigured);
+  cJSON_AddNumberToObject(json, "misconfigured_ms", state.is_misconfigured ? (uint32_t)(now_ms - state.misconfigured_since_ms) : 0);
+
+  cJSON* drifted_fields = cJSON_AddArrayToObject(json, "drifted_fields");
+  for (size_t i = 0; i < sizeof(DISPLAY_FIELD_NAMES) / sizeof(DISPLAY_FIELD_NAMES[0]); i++) {
+    if (state.drifted_fields & (1 << i)) cJSON_AddItemToArray(drifted_fields, cJSON_CreateString(DISPLAY_FIELD_NAMES[i]));
+  }
+
+  cJSON_AddNumberToObject(json, "convergences", state.convergence_count);
+  cJSON_AddNumberToObject(json, "last_convergence_ms", state.last_convergence_ms);
+  cJSON_AddNumberToObject(json, "max_convergence_ms", state.max_convergence_ms);
+  cJSON_AddNumberToObject(json, "total_misconfigured_ms", state.total_misconfigured_ms);
+  cJSON_AddNumberToObject(json, "attempts", state.attempt_count);
+  cJSON_AddNumberToObject(json, "failures", state.failure_count);
+  cJSON_AddNumberToObject(json, "consecutive_failures", state.consecutive_failures);
+  cJSON_AddNumberToObject(json, "retry_in_ms", std::max((int)(state.next_attempt_at_ms - now_ms), 0));
+  add_display_configuration(json, "desired", desired);
+  // Only what the last jobs actually applied; a field whose step failed is unknown.
+  add_display_configuration(json, "applied", applied_display_configuration, applied_display_fields);
+  return json;
+}
+
+int get_display_reconfigure_debounce_ms() {
+  int debounce_ms = get_property_snapshot()->get_int(VIRTUAL_DISPLAY_RECONFIGURE_DEBOUNCE_SYSTEM_PROPERTY_KEY);
+  return debounce_ms >= 0 ? debounce_ms : DEFAULT_DISPLAY_RECONFIGURE_DEBOUNCE_MS;
+}
+
+// Runs jobs one at a time, so two reconfigurations never interleave their commands.
+// A job only starts once no newer one arrived for the debounce window.
+void run_display_job_worker() {
+  while (true) {
+    std::shared_ptr<DisplayJob> job;
+    {
+      std::unique_lock<std::mutex> lock(display_job_mutex);
+      display_job_wakeup.wait(lock, [] { return pending_display_job != nullptr; });
+      while (true) {
+        uint32_t queued_at_ms = pending_display_job->queued_at_ms;
+        int debounce_ms = get_display_reconfigure_debounce_ms();
+        int waited_ms = (int)(monotonic_clock_ms() - queued_at_ms);
+        if (waited_ms >= debounce_ms) break;
+        display_job_wakeup.wait_for(lock, std::chrono::milliseconds(debounce_ms - waited_ms));
+      }
+      job = pending_display_job;
+      pending_display_job = nullptr;
+      is_display_job_running = true;
+      job->status = DISPLAY_JOB_RUNNING;
+      job->started_at_ms = monotonic_clock_ms();
+      job->changed_fields = get_changed_display_fields(applied_display_configuration, job->configuration) |
+                            (DISPLAY_FIELD_ALL & ~applied_display_fields);
+    }
+
+    configure_virtual_display(*job);
+
+    std::lock_guard<std::mutex> lock(display_job_mutex);
+    // A field only counts as applied when no step depending on it failed, so the next
+    // job runs those steps again.
+    unsigned int failed_fields = 0;
+    for (size_t i = 0; i < DISPLAY_JOB_STEP_COUNT; i++) {
+      if (job->steps[i].status == DISPLAY_JOB_STEP_FAILED) failed_fields |= DISPLAY_JOB_STEP_FIELDS[i];
+    }
+    applied_display_configuration = job->configuration;
+    applied_display_fields = DISPLAY_FIELD_ALL & ~failed_fields;
+
+    job->status = failed_fields != 0 ? DISPLAY_JOB_FAILED : DISPLAY_JOB_SUCCEEDED;
+    job->finished_at_ms = monotonic_clock_ms();
+    is_display_job_running = false;
+    record_display_job_outcome(*job);
+  }
+}
+
+void start_display_job_worker() {
+  std::thread(run_display_job_worker).detach();
+}
+
+// Must be called with display_job_mutex held.
+cJSON* create_display_job_status(const DisplayJob& job) {
+  uint32_t now_ms = monotonic_clock_ms();
+  cJSON* json = cJSON_CreateObject();
+  cJSON_AddNumberToObject(json, "id", job.id);
+  cJSON_AddStringToObject(json, "status", DISPLAY_JOB_STATUS_NAMES[job.status]);
+  cJSON_AddNumberToObject(json, "width", job.configuration.width);
+  cJSON_AddNumberToObject(json, "height", job.configuration.height);
+  cJSON_AddNumberToObject(json, "density", job.configuration.density);
+  cJSON_AddNumberToObject(json, "refreshRate", job.configuration.refresh_rate);
+  cJSON_AddNumberToObject(json, "age_ms", (uint32_t)(now_ms - job.queued_at_ms));
+  if (job.status == DISPLAY_JOB_SUPERSEDED) {
+    cJSON_AddNumberToObject(json, "superseded_by", job.superseded_by);
+  } else if (job.status != DISPLAY_JOB_QUEUED) {
+    uint32_t finished_at_ms = job.status == DISPLAY_JOB_RUNNING ? now_ms : job.finished_at_ms;
+    cJSON_AddNumberToObject(json, "duration_ms", (uint32_t)(finished_at_ms - job.started_at_ms));
+
+    cJSON* changed_fields = cJSON_AddArrayToObject(json, "changed_fields");
+    for (size_t i = 0; i < sizeof(DISPLAY_FIELD_NAMES) / sizeof(DISPLAY_FIELD_NAMES[0]); i++) {
+      if (job.changed_fields & (1 << i)) cJSON_AddItemToArray(changed_fields, cJSON_CreateString(DISPLAY_FIELD_NAMES[i]));
+    }
+  }
+
+  cJSON* steps = cJSON_AddArrayToObject(json, "steps");
+  for (size_t i = 0; i < DISPLAY_JOB_STEP_COUNT; i++) {
+    cJSON* step = cJSON_CreateObject();
+    cJSON_AddStringToObject(step, "name", DISPLAY_JOB_STEP_NAMES[i]);
+    cJSON_AddStringToObject(step, "status", DISPLAY_JOB_STEP_STATUS_NAMES[job.steps[i].status]);
+    if (job.steps[i].status == DISPLAY_JOB_STEP_SUCCEEDED || job.steps[i].status == DISPLAY_JOB_STEP_FAILED) {
+      cJSON_AddNumberToObject(step, "exit_status", job.steps[i].exit_status);
+      cJSON_AddNumberToObject(step, "duration_ms", job.steps[i].duration_ms);
+    }
+    cJSON_AddItemToArray(steps, step);
+  }
+  return json;
+}
+
+// Returns nullptr once the job has dropped out of the history.
+cJSON* create_display_job_status(uint64_t id) {
+  std::lock_guard<std::mutex> lock(display_job_mutex);
+  for (const std::shared_ptr<DisplayJob>& job : display_job_history) {
+    if (job->id == id) return create_display_job_status(*job);
+  }
+  return nullptr;
+}
+
+cJSON* create_display_job_history() {
+  std::lock_guard<std::mutex> lock(display_job_mutex);
+  cJSON* jobs = cJSON_CreateArray();
+  for (const std::shared_ptr<DisplayJob>& job : display_job_history) {
+    cJSON_AddItemToArray(jobs, create_display_job_status(*job));
+  }
+  return jobs;
+}
+
+// Points the client at a queued job: job_id and status_url in json, plus a Location header.
+void add_display_job_reference(cJSON* json, const DisplayJob& job, httplib::Response& res) {
+  std::string status_url = "/api/displayJobs/" + std::to_string(job.id);
+  cJSON_AddNumberToObject(json, "job_id", job.id);
+  cJSON_AddStringToObject(json, "status_url", status_url.c_str());
+  res.set_header("Location", status_url);
+}
+
+void handle_display_job_accepted(const DisplayJob& job, httplib::Response& res) {
+  cJSON* json = cJSON_CreateObject();
+  add_display_job_reference(json, job, res);
+
+  char* json_str = cJSON_Print(json);
+
+  res.set_content(json_str, "application/json");
+  res.status = 202;
+
+  cJSON_Delete(json);
+  free(json_str);
+}
+
+struct ThermalZone {
+  std::string name;
+  int fd;
+};
+
+const int DEFAULT_THERMAL_SAMPLE_INTERVAL_MS = 1000;
+const size_t THERMAL_HISTORY_CAPACITY = 3600;
+
+// Discovered once at startup; the temp files stay open and are re-read with pread().
+static std::vector<ThermalZone> thermal_zones;
+
+// Ring buffer of the last THERMAL_HISTORY_CAPACITY samples. Each sample is a timestamp and
+// one millidegree reading per zone, stored at temperatures[slot * zone count + zone].
+static std::mutex thermal_history_mutex;
+static std::vector<uint32_t> thermal_history_timestamps;
+static std::vector<int32_t> thermal_history_temperatures;
+static size_t thermal_history_next = 0;
+static size_t thermal_history_size = 0;
+
+bool read_thermal_zone(const ThermalZone& zone, int32_t* temperature) {
+  char buffer[16];
+  ssize_t length = pread(zone.fd, buffer, sizeof(buffer) - 1, 0);
+  if (length <= 0) return false;
+  buffer[length] = '\0';
+  *temperature = atoi(buffer);
+  return true;
+}
+
+std::string read_thermal_zone_type(const char* zone_path) {
+  char type[64] = "";
+  FILE* file = fopen((std::string(zone_path) + "/type").c_str(), "r");
+  if (file != NULL) {
+    if (fgets(type, sizeof(type), file) != NULL) type[strcspn(type, "\n")] = 0;
+    fclose(file);
+  }
+  return type;
+}
+
+void discover_thermal_zones() {
+  const char* thermal_path = "/sys/class/thermal";
+  DIR* dir = opendir(thermal_path);
+  if (dir == NULL) {
+    perror("Could not open /sys/class/thermal");
+    return;
+  }
+
+  std::vector<int> zone_ids;
+  struct dirent* entry;
+  while ((entry = readdir(dir)) != NULL) {
+    int zone_id;
+    if (sscanf(entry->d_name, "thermal_zone%d", &zone_id) == 1) zone_ids.push_back(zone_id);
+  }
+  closedir(dir);
+  std::sort(zone_ids.begin(), zone_ids.end());
+
+  for (int zone_id : zone_ids) {
+    std::string zone_path = std::string(thermal_path) + "/thermal_zone" + std::to_string(zone_id);
+    int fd = open((zone_path + "/temp").c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) continue;
+    std::string type = read_thermal_zone_type(zone_path.c_str());
+    thermal_zones.push_back({type.empty() ? "thermal_zone" + std::to_string(zone_id) : type, fd});
+  }
+
+  thermal_history_timestamps.resize(THERMAL_HISTORY_CAPACITY);
+  thermal_history_temperatures.resize(THERMAL_HISTORY_CAPACITY * thermal_zones.size());
+}
+
+void record_thermal_sample() {
+  std::vector<int32_t> temperatures(thermal_zones.size(), INT32_MIN);
+  for (size_t i = 0; i < thermal_zones.size(); i++) {
+    read_thermal_zone(thermal_zones[i], &temperatures[i]);
+  }
+
+  std::lock_guard<std::mutex> lock(thermal_history_mutex);
+  thermal_history_timestamps[thermal_history_next] = monotonic_clock_ms();
+  std::copy(temperatures.begin(), temperatures.end(), thermal_history_temperatures.begin() + thermal_history_next * thermal_zones.size());
+  thermal_history_next = (thermal_history_next + 1) % THERMAL_HISTORY_CAPACITY;
+  thermal_history_size = std::min(thermal_history_size + 1, THERMAL_HISTORY_CAPACITY);
+}
+
+void run_thermal_sampler() {
+  while (true) {
+    record_thermal_sample();
+    int interval_ms = get_property_snapshot()->get_int(THERMAL_SAMPLE_INTERVAL_SYSTEM_PROPERTY_KEY);
+    std::this_thread::sleep_for(std::chrono::milliseconds(interval_ms > 0 ? interval_ms : DEFAULT_THERMAL_SAMPLE_INTERVAL_MS));
+  }
+}
+
+void start_thermal_sampler() {
+  discover_thermal_zones();
+  if (thermal_zones.empty()) return;
+  record_thermal_sample();
+  std::thread(run_thermal_sampler).detach();
+}
+
+// Reads the latest sample of the first zone in whole degrees (-1 if it could not be read)
+// together with the time it was taken. Returns false before the first sample.
+bool get_cpu_temperature_sample(int* temperature, uint32_t* sampled_at_ms) {
+  std::lock_guard<std::mutex> lock(thermal_history_mutex);
+  if (thermal_history_size == 0) {
+    return false;
+  }
+
+  size_t latest = (thermal_history_next + THERMAL_HISTORY_CAPACITY - 1) % THERMAL_HISTORY_CAPACITY;
+  int32_t value = thermal_history_temperatures[latest * thermal_zones.size()];
+  *temperature = value != INT32_MIN ? value / 1000 : -1;
+  *sampled_at_ms = thermal_history_timestamps[latest];
+  return true;
+}
+
+// Returns the latest reading of the first zone in whole degrees, or -1 if none exists.
+int get_cpu_temperature() {
+  int temperature;
+  uint32_t sampled_at_ms;
+  return get_cpu_temperature_sample(&temperature, &sampled_at_ms) ? temperature : -1;
+}
+
+// Splits the last window_ms of history into bucket_count equal buckets and reports
+// min/max/avg per zone in degrees Celsius. Empty buckets are omitted.
+cJSON* create_thermal_history(uint32_t window_ms, int bucket_count) {
+  struct Bucket {
+    int32_t min_value = INT32_MAX;
+    int32_t max_value = INT32_MIN;
+    int64_t sum = 0;
+    int samples = 0;
+  };
+  std::vector<Bucket> buckets(thermal_zones.size() * bucket_count);
+  uint32_t bucket_ms = std::max<uint32_t>(window_ms / bucket_count, 1);
+  uint32_t now_ms = monotonic_clock_ms();
+
+  {
+    std::lock_guard<std::mutex> lock(thermal_history_mutex);
+    for (size_t n = 0; n < thermal_history_size; n++) {
+      size_t slot = (thermal_history_next + THERMAL_HISTORY_CAPACITY - 1 - n) % THERMAL_HISTORY_CAPACITY;
+      uint32_t age_ms = now_ms - thermal_history_timestamps[slot];
+      if (age_ms >= window_ms) break;
+
+      int bucket = bucket_count - 1 - std::min<int>(age_ms / bucket_ms, bucket_count - 1);
+      for (size_t zone = 0; zone < thermal_zones.size(); zone++) {
+        int32_t temperature = thermal_history_temperatures[slot * thermal_zones.size() + zone];
+        if (temperature == INT32_MIN) continue;
+        Bucket& b = buckets[zone * bucket_count + bucket];
+        b.min_value = std::min(b.min_value, temperature);
+        b.max_value = std::max(b.max_value, temperature);
+        b.sum += temperature;
+        b.samples++;
+      }
+    }
+  }
+
+  cJSON* zones = cJSON_CreateArray();
+  for (size_t zone = 0; zone < thermal_zones.size(); zone++) {
+    cJSON* zone_json = cJSON_CreateObject();
+    cJSON_AddStringToObject(zone_json, "name", thermal_zones[zone].name.c_str());
+    cJSON* zone_buckets = cJSON_AddArrayToObject(zone_json, "buckets");
+    for (int bucket = 0; bucket < bucket_count; bucket++) {
+      const Bucket& b = buckets[zone * bucket_count + bucket];
+      if (b.samples == 0) continue;
+      cJSON* bucket_json = cJSON_CreateObject();
+      cJSON_AddNumberToObject(bucket_json, "start_age_ms", (double)(bucket_count - bucket) * bucket_ms);
+      cJSON_AddNumberToObject(bucket_json, "min", b.min_value / 1000.0);
+      cJSON_AddNumberToObject(bucket_json, "max", b.max_value / 1000.0);
+      cJSON_AddNumberToObject(bucket_json, "avg", (double)b.sum / b.samples / 1000.0);
+      cJSON_AddNumberToObject(bucket_json, "samples", b.samples);
+      cJSON_AddItemToArray(zone_buckets, bucket_json);
+    }
+    cJSON_AddItemToArray(zones, zone_json);
+  }
+  return zones;
+}
+
+const int SYSTEM_TELEMETRY_INTERVAL_MS = 1000;
+
+struct CpuTimes {
+  bool is_present = false;
+  uint64_t busy = 0;
+  uint64_t total = 0;
+};
+
+// Raw counters from one pass over the telemetry sources. Rates are computed from the
+// difference between two consecutive samples.
+struct SystemCounters {
+  uint32_t sampled_at_ms = 0;
+  // Indexed by the /proc/stat label: [0] is the aggregate "cpu" line, [n + 1] is "cpuN".
+  // Offline cores have no line, so their entry is not present.
+  std::vector<CpuTimes> cpus;
+  std::vector<std::pair<std::string, std::array<uint64_t, 4>>> interfaces;  // rx bytes, rx packets, tx bytes, tx packets
+};
+
+struct PressureStall {
+  bool is_available = false;
+  double some_avg10 = 0;
+  double some_avg60 = 0;
+  double full_avg10 = 0;
+  double full_avg60 = 0;
+};
+
+struct InterfaceThroughput {
+  std::string name;
+  double rx_bytes_per_second;
+  double rx_packets_per_second;
+  double tx_bytes_per_second;
+  double tx_packets_per_second;
+};
+
+struct SystemTelemetry {
+  uint32_t sampled_at_ms;
+  uint32_t interval_ms;
+  std::vector<double> cpu_utilization;  // percent, same layout as SystemCounters::cpus, -1 if unknown
+  std::vector<int> cpu_frequency_khz;   // per core, -1 if unavailable
+  int64_t memory_total_kb = -1;
+  int64_t memory_available_kb = -1;
+  int64_t swap_total_kb = -1;
+  int64_t swap_free_kb = -1;
+  PressureStall cpu_pressure;
+  PressureStall memory_pressure;
+  std::vector<InterfaceThroughput> interfaces;
+};
+
+// Opened once at startup and re-read with pread(); -1 when the kernel does not provide the file.
+static int proc_stat_fd = -1;
+static int proc_meminfo_fd = -1;
+static int proc_net_dev_fd = -1;
+static int cpu_pressure_fd = -1;
+static int memory_pressure_fd = -1;
+static std::vector<int> cpu_frequency_fds;
+
+static std::shared_ptr<const SystemTelemetry> system_telemetry;
+
+bool read_proc_file(int fd, std::string& contents) {
+  contents.clear();
+  if (fd < 0) return false;
+
+  char buffer[4096];
+  off_t offset = 0;
+  ssize_t length;
+  while ((length = pread(fd, buffer, sizeof(buffer), offset)) > 0) {
+    contents.append(buffer, length);
+    offset += length;
+  }
+  return length == 0 && !contents.empty();
+}
+
+void read_cpu_counters(SystemCounters& counters, std::string& contents) {
+  if (!read_proc_file(proc_stat_fd, contents)) return;
+
+  std::istringstream lines(contents);
+  std::string line;
+  while (std::getline(lines, line) && line.compare(0, 3, "cpu") == 0) {
+    size_t slot = line[3] == ' ' ? 0 : strtoul(line.c_str() + 3, nullptr, 10) + 1;
+    if (slot >= counters.cpus.size()) counters.cpus.resize(slot + 1);
+
+    std::istringstream fields(line.substr(line.find(' ')));
+    uint64_t value, total = 0, idle = 0;
+    for (int column = 0; fields >> value; column++) {
+      // Guest time is already included in user and nice.
+      if (column >= 8) break;
+      total += value;
+      if (column == 3 || column == 4) idle += value;
+    }
+    counters.cpus[slot] = {true, total - idle, total};
+  }
+}
+
+void read_interface_counters(SystemCounters& counters, std::string& contents) {
+  if (!read_proc_file(proc_net_dev_fd, contents)) return;
+
+  std::istringstream lines(contents);
+  std::string line;
+  while (std::getline(lines, line)) {
+    size_t colon = line.find(':');
+    if (colon == std::string::npos) continue;
+
+    std::string name = line.substr(0, colon);
+    name.erase(0, name.find_first_not_of(' '));
+    if (name == "lo") continue;
+
+    uint64_t columns[10];
+    std::istringstream fields(line.substr(colon + 1));
+    for (uint64_t& column : columns) fields >> column;
+    if (fields.fail()) continue;
+    counters.interfaces.push_back({name, {columns[0], columns[1], columns[8], columns[9]}});
+  }
+}
+
+void read_memory_info(SystemTelemetry& telemetry, std::string& contents) {
+  if (!read_proc_file(proc_meminfo_fd, contents)) return;
+
+  std::istringstream lines(contents);
+  std::string line;
+  while (std::getline(lines, line)) {
+    char name[32];
+    long long value;
+    if (sscanf(line.c_str(), "%31[^:]: %lld", name, &value) != 2) continue;
+    if (strcmp(name, "MemTotal") == 0) telemetry.memory_total_kb = value;
+    else if (strcmp(name, "MemAvailable") == 0) telemetry.memory_available_kb = value;
+    else if (strcmp(name, "SwapTotal") == 0) telemetry.swap_total_kb = value;
+    else if (strcmp(name, "SwapFree") == 0) telemetry.swap_free_kb = value;
+  }
+}
+
+void read_pressure_stall(int fd, PressureStall& pressure, std::string& contents) {
+  if (!read_proc_file(fd, contents)) return;
+
+  std::istringstream lines(contents);
+  std::string line;
+  while (std::getline(lines, line)) {
+    char kind[8];
+    double avg10, avg60;
+    if (sscanf(line.c_str(), "%7s avg10=%lf avg60=%lf", kind, &avg10, &avg60) != 3) continue;
+    if (strcmp(kind, "some") == 0) {
+      pressure.some_avg10 = avg10;
+      pressure.some_avg60 = avg60;
+      pressure.is_available = true;
+    } else if (strcmp(kind, "full") == 0) {
+      pressure.full_avg10 = avg10;
+      pressure.full_avg60 = avg60;
+    }
+  }
+}
+
+void open_system_telemetry_sources() {
+  proc_stat_fd = open("/proc/stat", O_RDONLY | O_CLOEXEC);
+  proc_meminfo_fd = open("/proc/meminfo", O_RDONLY | O_CLOEXEC);
+  proc_net_dev_fd = open("/proc/net/dev", O_RDONLY | O_CLOEXEC);
+  cpu_pressure_fd = open("/proc/pressure/cpu", O_RDONLY | O_CLOEXEC);
+  memory_pressure_fd = open("/proc/pressure/memory", O_RDONLY | O_CLOEXEC);
+
+  long cpu_count = sysconf(_SC_NPROCESSORS_CONF);
+  for (long cpu = 0; cpu < cpu_count; cpu++) {
+    std::string path = "/sys/devices/system/cpu/cpu" + std::to_string(cpu) + "/cpufreq/scaling_cur_freq";
+    cpu_frequency_fds.push_back(open(path.c_str(), O_RDONLY | O_CLOEXEC));
+  }
+}
+
+double rate_per_second(uint64_t previous, uint64_t current, uint32_t interval_ms) {
+  return current >= previous ? (current - previous) * 1000.0 / interval_ms : 0;
+}
+
+void record_system_telemetry(const SystemCounters& previous, const SystemCounters& current) {
+  std::shared_ptr<SystemTelemetry> telemetry = std::make_shared<SystemTelemetry>();
+  std::string contents;
+
+  telemetry->sampled_at_ms = current.sampled_at_ms;
+  telemetry->interval_ms = std::max<uint32_t>(current.sampled_at_ms - previous.sampled_at_ms, 1);
+
+  // A core that went offline or came back in between has no usable delta. The aggregate
+  // line can also shrink when a core goes offline, which the same check catches.
+  for (size_t i = 0; i < current.cpus.size(); i++) {
+    const CpuTimes& now = current.cpus[i];
+    const CpuTimes& last = i < previous.cpus.size() ? previous.cpus[i] : CpuTimes();
+    if (!now.is_present || !last.is_present || now.total < last.total || now.busy < last.busy) {
+      telemetry->cpu_utilization.push_back(-1);
+      continue;
+    }
+    uint64_t total = now.total - last.total;
+    telemetry->cpu_utilization.push_back(total > 0 ? (now.busy - last.busy) * 100.0 / total : 0);
+  }
+
+  for (int fd : cpu_frequency_fds) {
+    telemetry->cpu_frequency_khz.push_back(read_proc_file(fd, contents) ? atoi(contents.c_str()) : -1);
+  }
+
+  read_memory_info(*telemetry, contents);
+  read_pressure_stall(cpu_pressure_fd, telemetry->cpu_pressure, contents);
+  read_pressure_stall(memory_pressure_fd, telemetry->memory_pressure, contents);
+
+  for (const auto& interface : current.interfaces) {
+    auto last = std::find_if(previous.interfaces.begin(), previous.interfaces.end(),
+                             [&interface](const auto& candidate) { return candidate.first == interface.first; });
+    if (last == previous.interfaces.end()) continue;
+    telemetry->interfaces.push_back({
+      interface.first,
+      rate_per_second(last->second[0], interface.second[0], telemetry->interval_ms),
+      rate_per_second(last->second[1], interface.second[1], telemetry->interval_ms),
+      rate_per_second(last->second[2], interface.second[2], telemetry->interval_ms),
+      rate_per_second(last->second[3], interface.second[3], telemetry->interval_ms),
+    });
+  }
+
+  std::atomic_store(&system_telemetry, std::shared_ptr<const SystemTelemetry>(telemetry));
+}
+
+SystemCounters read_system_counters() {
+  SystemCounters counters;
+  std::string contents;
+  counters.sampled_at_ms = monotonic_clock_ms();
+  read_cpu_counters(counters, contents);
+  read_interface_counters(counters, contents);
+  return counters;
+}
+
+void run_system_telemetry_sampler() {
+  SystemCounters previous = read_system_counters();
+  while (true) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(SYSTEM_TELEMETRY_INTERVAL_MS));
+    SystemCounters current = read_system_counters();
+    record_system_telemetry(previous, current);
+    previous = std::move(current);
+  }
+}
+
+void start_system_telemetry_sampler() {
+  open_system_telemetry_sources();
+  std::thread(run_system_telemetry_sampler).detach();
+}
+
+void add_pressure_stall(cJSON* json, const char* name, const PressureStall& pressure) {
+  if (!pressure.is_available) return;
+  cJSON* pressure_json = cJSON_AddObjectToObject(json, name);
+  cJSON_AddNumberToObject(pressure_json, "some_avg10", pressure.some_avg10);
+  cJSON_AddNumberToObject(pressure_json, "some_avg60", pressure.some_avg60);
+  cJSON_AddNumberToObject(pressure_json, "full_avg10", pressure.full_avg10);
+  cJSON_AddNumberToObject(pressure_json, "full_avg60", pressure.full_avg60);
+}
+
+// Returns nullptr until the sampler has two samples to compute rates from.
+cJSON* create_system_telemetry() {
+  std::shared_ptr<const SystemTelemetry> telemetry = std::atomic_load(&system_telemetry);
+  if (telemetry == nullptr) return nullptr;
+
+  cJSON* json = cJSON_CreateObject();
+  cJSON_AddNumberToObject(json, "age_ms", (uint32_t)(monotonic_clock_ms() - telemetry->sampled_at_ms));
+  cJSON_AddNumberToObject(json, "interval_ms", telemetry->interval_ms);
+
+  cJSON* cpu = cJSON_AddObjectToObject(json, "cpu");
+  if (!telemetry->cpu_utilization.empty()) {
+    cJSON_AddNumberToObject(cpu, "utilization", telemetry->cpu_utilization[0]);
+  }
+  cJSON* cores = cJSON_AddArrayToObject(cpu, "cores");
+  size_t core_count = std::max(telemetry->cpu_utilization.size() > 0 ? telemetry->cpu_utilization.size() - 1 : 0, telemetry->cpu_frequency_khz.size());
+  for (size_t core = 0; core < core_count; core++) {
+    cJSON* core_json = cJSON_CreateObject();
+    cJSON_AddNumberToObject(core_json, "utilization", core + 1 < telemetry->cpu_utilization.size() ? telemetry->cpu_utilization[core + 1] : -1);
+    cJSON_AddNumberToObject(core_json, "frequency_khz", core < telemetry->cpu_frequency_khz.size() ? telemetry->cpu_frequency_khz[core] : -1);
+    cJSON_AddItemToArray(cores, core_json);
+  }
+  add_pressure_stall(cpu, "pressure", telemetry->cpu_pressure);
+
+  cJSON* memory = cJSON_AddObjectToObject(json, "memory");
+  cJSON_AddNumberToObject(memory, "total_kb", telemetry->memory_total_kb);
+  cJSON_AddNumberToObject(memory, "available_kb", telemetry->memory_available_kb);
+  cJSON_AddNumberToObject(memory, "swap_total_kb", telemetry->swap_total_kb);
+  cJSON_AddNumberToObject(memory, "swap_free_kb", telemetry->swap_free_kb);
+  add_pressure_stall(memory, "pressure", telemetry->memory_pressure);
+
+  cJSON* interfaces = cJSON_AddObjectToObject(json, "interfaces");
+  for (const InterfaceThroughput& interface : telemetry->interfaces) {
+    cJSON* interface_json = cJSON_AddObjectToObject(interfaces, interface.name.c_str());
+    cJSON_AddNumberToObject(interface_json, "rx_bytes_per_second", interface.rx_bytes_per_second);
+    cJSON_AddNumberToObject(interface_json, "rx_packets_per_second", interface.rx_packets_per_second);
+    cJSON_AddNumberToObject(interface_json, "tx_bytes_per_second", interface.tx_bytes_per_second);
+    cJSON_AddNumberToObject(interface_json, "tx_packets_per_second", interface.tx_packets_per_second);
+  }
+  return json;
+}
+
+bool read_serial_number(char (&serial_number)[17]) {
+    uint32_t serial = 0;
+
+    FILE *fp = fopen("/sys/firmware/devicetree/base/serial-number", "r");
+
+    if (fp == NULL) {
+        perror("/sys/firmware/devicetree/base/serial-number");
+        return false;
+    }
+
+    if (fscanf(fp, "%x", &serial) != 1) {
+        perror("Failed to read serial number");
+        fclose(fp);
+        return false;
+    }
+
+    fclose(fp);
+
+    snprintf(serial_number, sizeof(serial_number), "%08x", serial);
+    return true;
+}
+
+// Facts that cannot change while the system is running, read once at startup.
+// A fact that could not be read is reported as null instead of failing the request.
+static cJSON* device_facts = nullptr;
+
+void load_device_facts() {
+  device_facts = cJSON_CreateObject();
+
+  char serial_number[17];
+  if (read_serial_number(serial_number)) {
+    cJSON_AddStringToObject(device_facts, "serial_number", serial_number);
+  } else {
+    cJSON_AddNullToObject(device_facts, "serial_number");
+  }
+
+  const char* device_model = get_system_property("ro.product.model");
+  if (device_model != nullptr) {
+    cJSON_AddStringToObject(device_facts, "device_model", device_model);
+  } else {
+    cJSON_AddNullToObject(device_facts, "device_model");
+  }
+}
+
+// Adds the facts as references, so responses share their strings instead of copying them.
+void add_device_facts(cJSON* json, const FieldSelector& selector) {
+  cJSON* fact;
+  cJSON_ArrayForEach(fact, device_facts) {
+    if (selector.includes(fact->string)) cJSON_AddItemReferenceToObject(json, fact->string, fact);
+  }
+}
+
+const char *DETECTOR_REGISTRY_PATH = "/system/etc/tesla-android-detectors.json";
+
+// Used when the registry file is missing or invalid. Generated from tesla-android-detectors.json
+// at build time, see Android.bp.
+const char *DEFAULT_DETECTOR_REGISTRY =
+#include "tesla-android-detectors.json.inc"
+;
+
+// Fields /api/deviceInfo reports besides the detectors. Detectors may not reuse them, nor the
+// property fields /api/events streams next to them.
+const char *RESERVED_DEVICE_INFO_FIELDS[] = {"cpu_temperature", "serial_number", "device_model", "release_type", "ota_url", "field_age_ms"};
+
+bool is_reserved_device_info_field(const std::string &field) {
+  for (const char *reserved : RESERVED_DEVICE_INFO_FIELDS) {
+    if (field == reserved) return true;
+  }
+  for (const PropertySchema &schema : PROPERTY_SCHEMA) {
+    if (schema.field != nullptr && field == schema.field) return true;
+  }
+  return false;
+}
+
+struct TcpEndpoint {
+  std::string ip;
+  int port;
+};
+
+// A detector reports 1 when every non-empty condition list has at least one hit.
+struct Detector {
+  std::string field;
+  int interval_ms;
+  int tcp_timeout_ms;
+  std::vector<UsbDevicePattern> usb_devices;
+  std::vector<TcpEndpoint> tcp_endpoints;
+  std::vector<std::string> interfaces;
+  std::vector<std::string> sysfs_paths;
+};
+
+static std::vector<Detector> detectors;
+
+int is_detected(const Detector &detector) {
+  if (!detector.usb_devices.empty() && !is_any_usb_device_present(detector.usb_devices.data(), detector.usb_devices.size())) {
+    return 0;
+  }
+
+  if (!detector.interfaces.empty() &&
+      std::none_of(detector.interfaces.begin(), detector.interfaces.end(), [](const std::string &name) { return does_interface_exist(name.c_str()); })) {
+    return 0;
+  }
+
+  if (!detector.sysfs_paths.empty() &&
+      std::none_of(detector.sysfs_paths.begin(), detector.sysfs_paths.end(), [](const std::string &path) { return access(path.c_str(), F_OK) == 0; })) {
+    return 0;
+  }
+
+  // Connects are the most expensive check, so they run only once everything else matched.
+  if (!detector.tcp_endpoints.empty()) {
+    std::vector<PortProbeTarget> targets;
+    for (const TcpEndpoint &endpoint : detector.tcp_endpoints) {
+      targets.push_back({endpoint.ip.c_str(), endpoint.port});
+    }
+    return is_any_port_open(targets.data(), targets.size(), detector.tcp_timeout_ms);
+  }
+  return 1;
+}
+
+bool parse_detector(const cJSON *json, Detector &detector) {
+  const cJSON *field = cJSON_GetObjectItemCaseSensitive(json, "field");
+  const cJSON *interval_ms = cJSON_GetObjectItemCaseSensitive(json, "interval_ms");
+  const cJSON *tcp_timeout_ms = cJSON_GetObjectItemCaseSensitive(json, "tcp_timeout_ms");
+  if (!cJSON_IsString(field)) return false;
+
+  detector.field = field->valuestring;
+  detector.interval_ms = cJSON_IsNumber(interval_ms) ? std::max(interval_ms->valueint, 100) : 5000;
+  detector.tcp_timeout_ms = cJSON_IsNumber(tcp_timeout_ms) ? std::max(tcp_timeout_ms->valueint, 1) : 1000;
+
+  const cJSON *item;
+  cJSON_ArrayForEach(item, cJSON_GetObjectItemCaseSensitive(json, "usb")) {
+    const cJSON *vendor_id = cJSON_GetObjectItemCaseSensitive(item, "vendor_id");
+    const cJSON *product_id = cJSON_GetObjectItemCaseSensitive(item, "product_id");
+    if (!cJSON_IsString(vendor_id) || !cJSON_IsString(product_id)) return false;
+    detector.usb_devices.push_back({(unsigned int)strtoul(vendor_id->valuestring, nullptr, 16), (unsigned int)strtoul(product_id->valuestring, nullptr, 16)});
+  }
+  cJSON_ArrayForEach(item, cJSON_GetObjectItemCaseSensitive(json, "tcp")) {
+    const cJSON *ip = cJSON_GetObjectItemCaseSensitive(item, "ip");
+    const cJSON *port = cJSON_GetObjectItemCaseSensitive(item, "port");
+    if (!cJSON_IsString(ip) || !cJSON_IsNumber(port)) return false;
+    detector.tcp_endpoints.push_back({ip->valuestring, port->valueint});
+  }
+  cJSON_ArrayForEach(item, cJSON_GetObjectItemCaseSensitive(json, "interfaces")) {
+    if (!cJSON_IsString(item)) return false;
+    detector.interfaces.push_back(item->valuestring);
+  }
+  cJSON_ArrayForEach(item, cJSON_GetObjectItemCaseSensitive(json, "sysfs_paths")) {
+    if (!cJSON_IsString(item)) return false;
+    detector.sysfs_paths.push_back(item->valuestring);
+  }
+  return true;
+}
+
+bool parse_detector_registry(const char *registry, std::vector<Detector> &parsed) {
+  cJSON *json = cJSON_Parse(registry);
+  const cJSON *item;
+  bool result = cJSON_IsArray(cJSON_GetObjectItemCaseSensitive(json, "detectors"));
+  cJSON_ArrayForEach(item, cJSON_GetObjectItemCaseSensitive(json, "detectors")) {
+    Detector detector;
+    if (!parse_detector(item, detector)) {
+      result = false;
+      break;
+    }
+    // A reused field would appear twice in the same response.
+    if (is_reserved_device_info_field(detector.field) ||
+        std::any_of(parsed.begin(), parsed.end(), [&detector](const Detector &other) { return other.field == detector.field; })) {
+      fprintf(stderr, "Detector field %s is already in use\n", detector.field.c_str());
+      result = false;
+      break;
+    }
+    parsed.push_back(detector);
+  }
+  cJSON_Delete(json);
+  return result;
+}
+
+void load_detector_registry() {
+  std::string registry;
+  FILE *file = fopen(DETECTOR_REGISTRY_PATH, "r");
+  if (file != NULL) {
+    char buffer[4096];
+    size_t length;
+    while ((length = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+      registry.append(buffer, length);
+    }
+    fclose(file);
+  }
+
+  if (registry.empty() || !parse_detector_registry(registry.c_str(), detectors)) {
+    fprintf(stderr, "Could not load %s, using built-in detectors\n", DETECTOR_REGISTRY_PATH);
+    detectors.clear();
+    parse_detector_registry(DEFAULT_DETECTOR_REGISTRY, detectors);
+  }
+}
+
+// Events that make a probe worth re-running before its interval expires.
+enum {
+  DEVICE_PROBE_TRIGGER_LINK = 1 << 0,
+  DEVICE_PROBE_TRIGGER_USB = 1 << 1,
+};
+
+struct DeviceProbe {
+  std::string field;
+  int interval_ms;
+  std::function<int()> sample;
+  unsigned int triggers;
+};
+
+const size_t DEVICE_PROBE_CPU_TEMPERATURE = 0;
+const size_t MAX_DEVICE_PROBES = 32;
+
+// Built once at startup: the CPU temperature followed by one probe per detector. The CPU
+// temperature has no sample function; it is read from the thermal history, which already
+// caches it, so its age is that of the thermal sample.
+static std::vector<DeviceProbe> device_probes;
+
+// Latest result of each probe packed as (sampled_at_ms << 32) | value, so a reader always
+// sees a value together with its own timestamp without taking a lock.
+static std::atomic<uint64_t> device_probe_samples[MAX_DEVICE_PROBES];
+static std::atomic<bool> device_probe_has_sample[MAX_DEVICE_PROBES];
+
+static std::mutex device_probe_mutex;
+static std::condition_variable device_probe_wakeup;
+static bool device_probe_requested[MAX_DEVICE_PROBES];
+
+// Runs the probes interested in an event ahead of their interval.
+void request_device_probes(unsigned int trigger) {
+  std::lock_guard<std::mutex> lock(device_probe_mutex);
+  for (size_t i = 0; i < device_probes.size(); i++) {
+    if (device_probes[i].triggers & trigger) device_probe_requested[i] = true;
+  }
+  device_probe_wakeup.notify_all();
+}
+
+void run_device_probe(size_t index) {
+  const DeviceProbe& probe = device_probes[index];
+  while (true) {
+    uint32_t value = probe.sample();
+    device_probe_samples[index].store((uint64_t(monotonic_clock_ms()) << 32) | value, std::memory_order_release);
+    device_probe_has_sample[index].store(true, std::memory_order_release);
+
+    std::unique_lock<std::mutex> lock(device_probe_mutex);
+    device_probe_wakeup.wait_for(lock, std::chrono::milliseconds(probe.interval_ms), [index] { return device_probe_requested[index]; });
+    device_probe_requested[index] = false;
+  }
+}
+
+// Each probe gets its own thread so a slow one (the modem connects) never delays the others.
+void start_device_sampler() {
+  load_detector_registry();
+
+  std::vector<DeviceProbe> probes;
+  probes.push_back({"cpu_temperature", 0, nullptr, 0});
+  for (const Detector& detector : detectors) {
+    if (probes.size() == MAX_DEVICE_PROBES) {
+      fprintf(stderr, "Too many detectors, ignoring %s\n", detector.field.c_str());
+      continue;
+    }
+    unsigned int triggers = (detector.usb_devices.empty() ? 0 : DEVICE_PROBE_TRIGGER_USB) |
+                            (detector.interfaces.empty() ? 0 : DEVICE_PROBE_TRIGGER_LINK);
+    probes.push_back({detector.field, detector.interval_ms, [&detector] { return is_detected(detector); }, triggers});
+  }
+
+  // The trackers may already be requesting probes.
+  {
+    std::lock_guard<std::mutex> lock(device_probe_mutex);
+    device_probes = std::move(probes);
+  }
+
+  for (size_t i = 0; i < device_probes.size(); i++) {
+    if (device_probes[i].sample) std::thread(run_device_probe, i).detach();
+  }
+}
+
+// Applies one RTM_NEWLINK/RTM_DELLINK message. Returns true if an interface appeared,
+// disappeared or changed its operational state.
+bool handle_link_message(struct nlmsghdr *message) {
+  struct ifinfomsg *ifi = (struct ifinfomsg *)NLMSG_DATA(message);
+  int length = IFLA_PAYLOAD(message);
+  const char *name = nullptr;
+  uint8_t operstate = IF_OPER_UNKNOWN;
+
+  for (struct rtattr *rta = IFLA_RTA(ifi); RTA_OK(rta, length); rta = RTA_NEXT(rta, length)) {
+    if (rta->rta_type == IFLA_IFNAME) {
+      name = (const char *)RTA_DATA(rta);
+    } else if (rta->rta_type == IFLA_OPERSTATE) {
+      operstate = *(uint8_t *)RTA_DATA(rta);
+    }
+  }
+  if (name == nullptr) return false;
+
+  std::lock_guard<std::mutex> lock(network_interfaces_mutex);
+  if (message->nlmsg_type == RTM_DELLINK) {
+    return network_interfaces.erase(name) > 0;
+  }
+  std::unordered_map<std::string, NetworkInterface>::iterator existing = network_interfaces.find(name);
+  bool has_changed = existing == network_interfaces.end() || existing->second.operstate != operstate;
+  network_interfaces[name] = {ifi->ifi_index, ifi->ifi_flags, operstate};
+  return has_changed;
+}
+
+bool request_link_dump(int sockfd) {
+  struct {
+    struct nlmsghdr header;
+    struct ifinfomsg body;
+  } request;
+  memset(&request, 0, sizeof(request));
+  request.header.nlmsg_len = NLMSG_LENGTH(sizeof(struct ifinfomsg));
+  request.header.nlmsg_type = RTM_GETLINK;
+  request.header.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+  request.body.ifi_family = AF_UNSPEC;
+  return send(sockfd, &request, request.header.nlmsg_len, 0) >= 0;
+}
+
+// Subscribes to link notifications, then dumps the current links. Until the dump has
+// completed, does_interface_exist() keeps using SIOCGIFINDEX.
+void track_network_interfaces() {
+  int sockfd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE);
+  if (sockfd < 0) {
+    perror("Netlink socket creation failed");
+    return;
+  }
+
+  struct sockaddr_nl address;
+  memset(&address, 0, sizeof(address));
+  address.nl_family = AF_NETLINK;
+  address.nl_groups = RTMGRP_LINK;
+  if (bind(sockfd, (struct sockaddr *)&address, sizeof(address)) < 0 || !request_link_dump(sockfd)) {
+    perror("Netlink subscription failed");
+    close(sockfd);
+    return;
+  }
+
+  char buffer[16384];
+  while (true) {
+    ssize_t length = recv(sockfd, buffer, sizeof(buffer), 0);
+    if (length < 0) {
+      if (errno == EINTR) continue;
+      if (errno != ENOBUFS) {
+        perror("Netlink receive failed");
+        break;
+      }
+      // Notifications were dropped, so the set may be stale. Rebuild it from a fresh dump.
+      network_interfaces_tracked.store(false, std::memory_order_release);
+      {
+        std::lock_guard<std::mutex> lock(network_interfaces_mutex);
+        network_interfaces.clear();
+      }
+      request_link_dump(sockfd);
+      continue;
+    }
+
+    bool has_changed = false;
+    int remaining = length;
+    for (struct nlmsghdr *message = (struct nlmsghdr *)buffer; NLMSG_OK(message, remaining); message = NLMSG_NEXT(message, remaining)) {
+      if (message->nlmsg_type == NLMSG_DONE) {
+        network_interfaces_tracked.store(true, std::memory_order_release);
+      } else if (message->nlmsg_type == RTM_NEWLINK || message->nlmsg_type == RTM_DELLINK) {
+        has_changed |= handle_link_message(message);
+      }
+    }
+
+    if (has_changed && network_interfaces_tracked.load(std::memory_order_acquire)) {
+      request_device_probes(DEVICE_PROBE_TRIGGER_LINK);
+    }
+  }
+
+  network_interfaces_tracked.store(false, std::memory_order_release);
+  close(sockfd);
+}
+
+void start_network_interface_tracker() {
+  std::thread(track_network_interfaces).detach();
 }
 
-void add_string_property(cJSON* json, const char* prop_name, const char* prop_value, httplib::Response& res) {
-  if (prop_value == NULL) {
-    handle_error(res);
+void seed_usb_devices() {
+  DIR *dir = opendir(USB_DEVICES_PATH);
+  if (dir == nullptr) {
+    perror("Could not open /sys/bus/usb/devices");
     return;
   }
-  cJSON_AddStringToObject(json, prop_name, prop_value);
-}
 
-void add_number_property(cJSON* json, const char* prop_name, int prop_value, httplib::Response& res) {
-  cJSON_AddNumberToObject(json, prop_name, prop_value);
+  struct dirent *entry;
+  while ((entry = readdir(dir)) != nullptr) {
+    if (entry->d_name[0] == '.') continue;
+
+    std::string device_path = std::string(USB_DEVICES_PATH) + "/" + entry->d_name;
+    unsigned int vendor_id, product_id;
+    char resolved_path[PATH_MAX];
+    if (!read_usb_id_at(dirfd(dir), entry->d_name, "idVendor", &vendor_id) || !read_usb_id_at(dirfd(dir), entry->d_name, "idProduct", &product_id) ||
+        realpath(device_path.c_str(), resolved_path) == nullptr || strncmp(resolved_path, "/sys", 4) != 0) {
+      continue;
+    }
+    // uevents identify devices by their path below /sys.
+    add_usb_device(resolved_path + 4, usb_device_key(vendor_id, product_id));
+  }
+  closedir(dir);
 }
 
-void configure_virtual_display(int width, int height, int density, int refreshRate) {
-  const char* binaryPath = "/system/bin/wm";
+// Applies one kernel uevent. Returns true if a USB device was added or removed.
+bool handle_usb_uevent(const char *message, size_t length) {
+  const char *action = nullptr, *devpath = nullptr, *subsystem = nullptr, *devtype = nullptr, *product = nullptr;
+  for (const char *field = message; field < message + length; field += strlen(field) + 1) {
+    if (strncmp(field, "ACTION=", 7) == 0) action = field + 7;
+    else if (strncmp(field, "DEVPATH=", 8) == 0) devpath = field + 8;
+    else if (strncmp(field, "SUBSYSTEM=", 10) == 0) subsystem = field + 10;
+    else if (strncmp(field, "DEVTYPE=", 8) == 0) devtype = field + 8;
+    else if (strncmp(field, "PRODUCT=", 8) == 0) product = field + 8;
+  }
 
-  std::ostringstream resolutionStream, densityStream;
-  resolutionStream << width << "x" << height << "@" << refreshRate;
+  if (action == nullptr || devpath == nullptr || subsystem == nullptr || devtype == nullptr ||
+      strcmp(subsystem, "usb") != 0 || strcmp(devtype, "usb_device") != 0) {
+    return false;
+  }
 
-  densityStream << density;
+  if (strcmp(action, "remove") == 0) {
+    return remove_usb_device(devpath);
+  }
 
-  std::string resolutionStr = resolutionStream.str();
-  std::string densityStr = densityStream.str();
+  // PRODUCT is "<vid>/<pid>/<bcdDevice>" in hex without leading zeros.
+  unsigned int vendor_id, product_id;
+  if (strcmp(action, "add") != 0 || product == nullptr || sscanf(product, "%x/%x", &vendor_id, &product_id) != 2) {
+    return false;
+  }
+  return add_usb_device(devpath, usb_device_key(vendor_id, product_id));
+}
 
-  const char* resolution = resolutionStr.c_str();
-  const char* densityCStr = densityStr.c_str();
+// Subscribes to kernel uevents before seeding from sysfs, so no hotplug is missed in between.
+void track_usb_devices() {
+  int sockfd = socket(AF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC, NETLINK_KOBJECT_UEVENT);
+  if (sockfd < 0) {
+    perror("Uevent socket creation failed");
+    return;
+  }
 
-  //Disable old overrides
-  pid_t pid = fork();
-  int status;
-  if (pid == -1) {
-    perror("fork failed");
-    exit(-1);
-  } else if (pid == 0) {
-    execlp(binaryPath, binaryPath, "size", "reset", NULL);
-    perror("execlp failed");
-    exit(-1);
-  }
-  wait(&status);
-  printf("child exit status: %d\n", WEXITSTATUS(status));
+  struct sockaddr_nl address;
+  memset(&address, 0, sizeof(address));
+  address.nl_family = AF_NETLINK;
+  address.nl_groups = 1;
+  if (bind(sockfd, (struct sockaddr *)&address, sizeof(address)) < 0) {
+    perror("Uevent subscription failed");
+    close(sockfd);
+    return;
+  }
 
-  // Set density
-  pid = fork();
-  if (pid == -1) {
-    perror("fork failed");
-    exit(-1);
-  } else if (pid == 0) {
-    execlp(binaryPath, binaryPath, "density", densityCStr, NULL);
-    perror("execlp failed");
-    exit(-1);
-  }
-  wait(&status);
-  printf("child exit status: %d\n", WEXITSTATUS(status));
-
-  // Unload virtual touchscreen module
-  const char* rmmodPath = "/vendor/bin/rmmod";
-  pid = fork();
-  if (pid == -1) {
-    perror("fork failed");
-    exit(-1);
-  } else if (pid == 0) {
-    execlp(rmmodPath, rmmodPath, "virtual_touchscreen", NULL);
-    perror("execlp failed");
-    exit(-1);
-  }
-  wait(NULL);
+  seed_usb_devices();
+  usb_devices_tracked.store(true, std::memory_order_release);
+  request_device_probes(DEVICE_PROBE_TRIGGER_USB);
+
+  char buffer[8192];
+  while (true) {
+    ssize_t length = recv(sockfd, buffer, sizeof(buffer) - 1, 0);
+    if (length < 0) {
+      if (errno == EINTR) continue;
+      if (errno != ENOBUFS) {
+        perror("Uevent receive failed");
+        break;
+      }
+      // Events were dropped. Reseed, since a removal may be among them.
+      usb_devices_tracked.store(false, std::memory_order_release);
+      {
+        std::lock_guard<std::mutex> lock(usb_devices_mutex);
+        usb_devices_by_path.clear();
+        usb_device_counts.clear();
+      }
+      seed_usb_devices();
+      usb_devices_tracked.store(true, std::memory_order_release);
+      request_device_probes(DEVICE_PROBE_TRIGGER_USB);
+      continue;
+    }
 
-  // Load virtual touchscreen
-  const char* modprobePath = "/vendor/bin/modprobe";
+    buffer[length] = '\0';
+    if (handle_usb_uevent(buffer, length)) {
+      request_device_probes(DEVICE_PROBE_TRIGGER_USB);
+    }
+  }
 
-  std::ostringstream absXMaxStream, absYMaxStream;
-  absXMaxStream << "abs_x_max_param=" << width;
-  absYMaxStream << "abs_y_max_param=" << height;
-  std::string absXMaxParam = absXMaxStream.str();
-  std::string absYMaxParam = absYMaxStream.str();
+  usb_devices_tracked.store(false, std::memory_order_release);
+  close(sockfd);
+}
 
-  const char* absXMaxCStr = absXMaxParam.c_str();
-  const char* absYMaxCStr = absYMaxParam.c_str();
+void start_usb_device_tracker() {
+  std::thread(track_usb_devices).detach();
+}
 
-  pid = fork();
-  if (pid == -1) {
-    perror("fork failed");
-    exit(-1);
-  } else if (pid == 0) {
-    execlp(modprobePath, modprobePath, "-d", "/vendor/lib/modules", "-a", "virtual_touchscreen", absXMaxCStr, absYMaxCStr, NULL);
-    perror("execlp failed");
-    exit(-1);
+struct DeviceState {
+  size_t count;
+  int values[MAX_DEVICE_PROBES];
+  // Milliseconds since each value was sampled, or -1 before the first sample.
+  int64_t age_ms[MAX_DEVICE_PROBES];
+};
+
+DeviceState get_device_state() {
+  DeviceState state;
+  uint32_t now_ms = monotonic_clock_ms();
+  state.count = device_probes.size();
+  for (size_t i = 0; i < state.count; i++) {
+    if (i == DEVICE_PROBE_CPU_TEMPERATURE) {
+      int temperature;
+      uint32_t sampled_at_ms;
+      bool has_sample = get_cpu_temperature_sample(&temperature, &sampled_at_ms);
+      state.values[i] = has_sample ? temperature : -1;
+      state.age_ms[i] = has_sample ? static_cast<uint32_t>(now_ms - sampled_at_ms) : -1;
+      continue;
+    }
+    if (!device_probe_has_sample[i].load(std::memory_order_acquire)) {
+      state.values[i] = -1;
+      state.age_ms[i] = -1;
+      continue;
+    }
+    uint64_t sample = device_probe_samples[i].load(std::memory_order_acquire);
+    state.values[i] = static_cast<int32_t>(sample & 0xffffffff);
+    state.age_ms[i] = static_cast<uint32_t>(now_ms - static_cast<uint32_t>(sample >> 32));
   }
-  wait(&status);
-  printf("child exit status: %d\n", WEXITSTATUS(status));
+  return state;
+}
 
-  // Check current headless resolution
-  std::string headlessOverrideValueStr = std::string(get_system_property(HEADLESS_CONFIG_OVERRIDE_PROPERTY_KEY));
-  int isHeadless = get_system_property_int(HEADLESS_CONFIG_IS_ENABLED_PROPERTY_KEY);
-  if (headlessOverrideValueStr == resolutionStr) {
-    printf("Headless override config unchanged");
-  } if (isHeadless == 0) {
-    printf("Not in headless mode, resize not needed");
-  } else {
-    printf("Headless override config needs update, triggering the lath");
-    system("stop tesla-android-virtual-display");
-    property_set(HEADLESS_CONFIG_OVERRIDE_PROPERTY_KEY, resolution);
-    property_set(HEADLESS_CONFIG_LATCH_PROPERTY_KEY, "1");
-    sleep(1);
-    system("start tesla-android-virtual-display");
+void add_device_state_properties(cJSON* json, const DeviceState& state, httplib::Response& res) {
+  for (size_t i = 0; i < state.count; i++) {
+    add_number_property(json, device_probes[i].field.c_str(), state.values[i], res);
   }
 }
 
-int get_cpu_temperature() {
-    FILE* file = fopen("/sys/class/thermal/thermal_zone0/temp", "r");
-    if (file == NULL) {
-        printf("Failed to open the file.\n");
-        return -1;
-    }
+void add_device_state_ages(cJSON* json, const DeviceState& state, httplib::Response& res, const FieldSelector& selector) {
+  for (size_t i = 0; i < state.count; i++) {
+    if (selector.includes(device_probes[i].field.c_str())) add_number_property(json, device_probes[i].field.c_str(), state.age_ms[i], res);
+  }
+}
 
-    int temperature;
-    fscanf(file, "%d", &temperature);
+// /api/events and /api/watch keep their httplib pool thread while they wait, and the pool
+// only has CPPHTTPLIB_THREAD_POOL_COUNT threads (8 on our hardware). Capping them together
+// leaves threads for every other endpoint.
+const int MAX_LONG_POLL_REQUESTS = 4;
+static std::atomic<int> long_poll_requests(0);
 
-    fclose(file);
+struct LongPollSlot {
+  ~LongPollSlot() {
+    long_poll_requests.fetch_sub(1);
+  }
+};
 
-    int temperatureCelsius = temperature / 1000;
-    return temperatureCelsius;
+// Returns nullptr when all slots are taken. The slot is released with the last reference.
+std::shared_ptr<LongPollSlot> acquire_long_poll_slot() {
+  if (long_poll_requests.fetch_add(1) >= MAX_LONG_POLL_REQUESTS) {
+    long_poll_requests.fetch_sub(1);
+    return nullptr;
+  }
+  return std::make_shared<LongPollSlot>();
 }
 
-char* get_serial_number() {
-    uint32_t serial = 0;
-    static char serialStr[17];
-
-    FILE *fp = fopen("/sys/firmware/devicetree/base/serial-number", "r");
-
-    if (fp == NULL) {
-        perror("/sys/firmware/devicetree/base/serial-number");
-        exit(EXIT_FAILURE);
+const int EVENT_STREAM_DEVICE_STATE_INTERVAL_MS = 1000;
+
+// Per-connection state of /api/events. Holds the last value sent for every field so
+// each event only carries what changed since the previous one.
+struct EventStream {
+  uint64_t version = 0;
+  std::chrono::steady_clock::time_point next_device_sample;
+  DeviceState device_state;
+  std::map<std::string, double> sent_values;
+};
+
+// Waits for the next change and writes it as one server-sent event. When nothing changed,
+// writes a keep-alive once per device sample interval instead.
+bool write_next_event(EventStream& stream, httplib::DataSink& sink, httplib::Response& res) {
+  while (true) {
+    // Rounds up so the wait never ends just short of the sample and spins until it is due.
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    int timeout_ms = std::chrono::ceil<std::chrono::milliseconds>(stream.next_device_sample - now).count();
+    std::shared_ptr<const PropertySnapshot> snapshot = wait_for_property_snapshot(stream.version, std::max(timeout_ms, 0));
+    bool is_timed_out = snapshot->version == stream.version;
+    stream.version = snapshot->version;
+
+    bool is_sampled = is_timed_out || std::chrono::steady_clock::now() >= stream.next_device_sample;
+    if (is_sampled) {
+      stream.device_state = get_device_state();
+      stream.next_device_sample = std::chrono::steady_clock::now() + std::chrono::milliseconds(EVENT_STREAM_DEVICE_STATE_INTERVAL_MS);
     }
 
-    if (fscanf(fp, "%x", &serial) != 1) {
-        perror("Failed to read serial number");
-        fclose(fp);
-        exit(EXIT_FAILURE);
+    cJSON* state = cJSON_CreateObject();
+    add_configuration_properties(state, *snapshot, res);
+    add_display_state_properties(state, *snapshot, res);
+    add_device_state_properties(state, stream.device_state, res);
+
+    cJSON* changes = cJSON_CreateObject();
+    cJSON* field;
+    cJSON_ArrayForEach(field, state) {
+      std::map<std::string, double>::iterator sent = stream.sent_values.find(field->string);
+      if (sent == stream.sent_values.end() || sent->second != field->valuedouble) {
+        stream.sent_values[field->string] = field->valuedouble;
+        cJSON_AddNumberToObject(changes, field->string, field->valuedouble);
+      }
     }
 
-    fclose(fp);
+    std::string event;
+    if (cJSON_GetArraySize(changes) > 0) {
+      char* changes_str = cJSON_PrintUnformatted(changes);
+      event = "event: change\nid: " + std::to_string(stream.version) + "\ndata: " + changes_str + "\n\n";
+      free(changes_str);
+    } else if (is_sampled) {
+      // Keeps proxies from closing the connection and detects disconnected clients.
+      event = ": keep-alive\n\n";
+    }
 
-    snprintf(serialStr, sizeof(serialStr), "%08x", serial);
-    return serialStr;
+    cJSON_Delete(state);
+    cJSON_Delete(changes);
+    if (!event.empty()) {
+      return sink.write(event.data(), event.size());
+    }
+  }
 }
 
 void start_softap() { 
-  system("iw reg set PH");
+  run_logged_process({"iw", "reg", "set", "PH"});
   sleep(1);
-  system("cmd wifi start-softap-with-existing-config");
+  run_logged_process({"cmd", "wifi", "start-softap-with-existing-config"});
 }
 
 void stop_softap() {
-  system("cmd wifi stop-softap");
+  run_logged_process({"cmd", "wifi", "stop-softap"});
 }
 
 void start_softap_if_enabled() {
@@ -331,23 +2449,189 @@ void start_softap_if_enabled() {
   //}
 }
 
-void set_initial_display_resolution() {
-  int width = get_system_property_int(VIRTUAL_DISPLAY_RESOLUTION_WIDTH_SYSTEM_PROPERTY_KEY);
-  int height = get_system_property_int(VIRTUAL_DISPLAY_RESOLUTION_HEIGHT_SYSTEM_PROPERTY_KEY);
-  int density = get_system_property_int(VIRTUAL_DISPLAY_DENSITY_SYSTEM_PROPERTY_KEY);
-  int refresh_rate = get_system_property_int(VIRTUAL_DISPLAY_REFRESH_RATE_SYSTEM_PROPERTY_KEY);
-  configure_virtual_display(width, height, density, refresh_rate);
+std::shared_ptr<DisplayJob> configure_virtual_display_from_properties() {
+  return enqueue_display_job(get_display_configuration(*get_property_snapshot()));
+}
+
+const int THERMAL_GOVERNOR_INTERVAL_MS = 5000;
+// Minimum time between two level changes, so one reading near a threshold cannot flap.
+const int THERMAL_GOVERNOR_HOLD_MS = 30000;
+const int THERMAL_GOVERNOR_MAX_LEVEL = 3;
+const int THERMAL_GOVERNOR_QUALITY_STEP = 15;
+const int THERMAL_GOVERNOR_MIN_QUALITY = 20;
+const int THERMAL_GOVERNOR_THROTTLED_REFRESH_RATE = 30;
+const int DEFAULT_THERMAL_GOVERNOR_THROTTLE_TEMPERATURE = 80;
+const int DEFAULT_THERMAL_GOVERNOR_RESTORE_TEMPERATURE = 70;
+const size_t THERMAL_GOVERNOR_DECISION_HISTORY = 32;
+
+struct ThermalGovernorDecision {
+  uint32_t timestamp_ms;
+  int temperature;
+  int from_level;
+  int to_level;
+};
+
+// Level 0 leaves the user's settings alone. Every level above it lowers the quality by one
+// step, and from level 2 on the refresh rate is capped as well.
+struct ThermalGovernorState {
+  int level = 0;
+  int temperature = -1;
+  int user_quality = -1;
+  int user_refresh_rate = -1;
+  int applied_quality = -1;
+  int applied_refresh_rate = -1;
+  uint32_t last_change_ms = 0;
+  std::vector<ThermalGovernorDecision> decisions;
+};
+
+static std::mutex thermal_governor_mutex;
+static ThermalGovernorState thermal_governor;
+
+int thermal_governor_quality(int user_quality, int level) {
+  if (level == 0 || user_quality <= THERMAL_GOVERNOR_MIN_QUALITY) return user_quality;
+  return std::max(user_quality - level * THERMAL_GOVERNOR_QUALITY_STEP, THERMAL_GOVERNOR_MIN_QUALITY);
+}
+
+int thermal_governor_refresh_rate(int user_refresh_rate, int level) {
+  return level >= 2 ? std::min(user_refresh_rate, THERMAL_GOVERNOR_THROTTLED_REFRESH_RATE) : user_refresh_rate;
+}
+
+// If the service stopped while throttled, the user's own values are still saved.
+void restore_thermal_governor_user_values() {
+  std::shared_ptr<const PropertySnapshot> snapshot = get_property_snapshot();
+  const char* user_quality = snapshot->get(THERMAL_GOVERNOR_USER_QUALITY_SYSTEM_PROPERTY_KEY);
+  const char* user_refresh_rate = snapshot->get(THERMAL_GOVERNOR_USER_REFRESH_RATE_SYSTEM_PROPERTY_KEY);
+  if (user_quality == nullptr || user_refresh_rate == nullptr) return;
+
+  PropertyWriteBatch batch;
+  batch.set(VIRTUAL_DISPLAY_QUALITY_SYSTEM_PROPERTY_KEY, std::string(user_quality));
+  batch.set(VIRTUAL_DISPLAY_REFRESH_RATE_SYSTEM_PROPERTY_KEY, std::string(user_refresh_rate));
+  batch.set(THERMAL_GOVERNOR_USER_QUALITY_SYSTEM_PROPERTY_KEY, std::string());
+  batch.set(THERMAL_GOVERNOR_USER_REFRESH_RATE_SYSTEM_PROPERTY_KEY, std::string());
+  batch.commit();
+}
+
+void run_thermal_governor_step() {
+  std::shared_ptr<const PropertySnapshot> snapshot = get_property_snapshot();
+  bool is_enabled = snapshot->get_int(THERMAL_GOVERNOR_IS_ENABLED_SYSTEM_PROPERTY_KEY) == 1;
+  int throttle_temperature = snapshot->get_int(THERMAL_GOVERNOR_THROTTLE_TEMPERATURE_SYSTEM_PROPERTY_KEY);
+  int restore_temperature = snapshot->get_int(THERMAL_GOVERNOR_RESTORE_TEMPERATURE_SYSTEM_PROPERTY_KEY);
+  if (throttle_temperature < 0) throttle_temperature = DEFAULT_THERMAL_GOVERNOR_THROTTLE_TEMPERATURE;
+  if (restore_temperature < 0) restore_temperature = DEFAULT_THERMAL_GOVERNOR_RESTORE_TEMPERATURE;
+  restore_temperature = std::min(restore_temperature, throttle_temperature - 1);
+
+  int quality = snapshot->get_int(VIRTUAL_DISPLAY_QUALITY_SYSTEM_PROPERTY_KEY);
+  int refresh_rate = snapshot->get_int(VIRTUAL_DISPLAY_REFRESH_RATE_SYSTEM_PROPERTY_KEY);
+  int temperature = get_cpu_temperature();
+  uint32_t now_ms = monotonic_clock_ms();
+
+  std::unique_lock<std::mutex> lock(thermal_governor_mutex);
+  ThermalGovernorState& state = thermal_governor;
+  state.temperature = temperature;
+
+  // A value that differs from what the governor wrote was set by the user meanwhile.
+  if (state.level == 0 || quality != state.applied_quality) state.user_quality = quality;
+  if (state.level == 0 || refresh_rate != state.applied_refresh_rate) state.user_refresh_rate = refresh_rate;
+  if (state.user_quality < 0 || state.user_refresh_rate < 0) return;
+
+  bool can_change = now_ms - state.last_change_ms >= (uint32_t)THERMAL_GOVERNOR_HOLD_MS || state.decisions.empty();
+  int level = state.level;
+  if (!is_enabled || temperature < 0) {
+    level = 0;
+  } else if (can_change && temperature >= throttle_temperature && level < THERMAL_GOVERNOR_MAX_LEVEL) {
+    level++;
+  } else if (can_change && temperature <= restore_temperature && level > 0) {
+    level--;
+  }
+
+  int target_quality = thermal_governor_quality(state.user_quality, level);
+  int target_refresh_rate = thermal_governor_refresh_rate(state.user_refresh_rate, level);
+  if (level != state.level) {
+    state.decisions.push_back({now_ms, temperature, state.level, level});
+    if (state.decisions.size() > THERMAL_GOVERNOR_DECISION_HISTORY) state.decisions.erase(state.decisions.begin());
+    state.level = level;
+    state.last_change_ms = now_ms;
+  } else if (target_quality == quality && target_refresh_rate == refresh_rate) {
+    return;
+  }
+
+  state.applied_quality = target_quality;
+  state.applied_refresh_rate = target_refresh_rate;
+
+  PropertyWriteBatch batch;
+  batch.set(VIRTUAL_DISPLAY_QUALITY_SYSTEM_PROPERTY_KEY, target_quality);
+  batch.set(VIRTUAL_DISPLAY_REFRESH_RATE_SYSTEM_PROPERTY_KEY, target_refresh_rate);
+  batch.set(THERMAL_GOVERNOR_USER_QUALITY_SYSTEM_PROPERTY_KEY, level > 0 ? std::to_string(state.user_quality) : std::string());
+  batch.set(THERMAL_GOVERNOR_USER_REFRESH_RATE_SYSTEM_PROPERTY_KEY, level > 0 ? std::to_string(state.user_refresh_rate) : std::string());
+  lock.unlock();
+
+  if (batch.commit() && target_refresh_rate != refresh_rate) {
+    configure_virtual_display_from_properties();
+  }
+}
+
+void run_thermal_governor() {
+  while (true) {
+    run_thermal_governor_step();
+    std::this_thread::sleep_for(std::chrono::milliseconds(THERMAL_GOVERNOR_INTERVAL_MS));
+  }
+}
+
+void start_thermal_governor() {
+  std::thread(run_thermal_governor).detach();
+}
+
+cJSON* create_thermal_governor_state() {
+  std::shared_ptr<const PropertySnapshot> snapshot = get_property_snapshot();
+  std::lock_guard<std::mutex> lock(thermal_governor_mutex);
+  const ThermalGovernorState& state = thermal_governor;
+  uint32_t now_ms = monotonic_clock_ms();
+
+  cJSON* json = cJSON_CreateObject();
+  cJSON_AddNumberToObject(json, "is_enabled", snapshot->get_int(THERMAL_GOVERNOR_IS_ENABLED_SYSTEM_PROPERTY_KEY) == 1);
+  cJSON_AddNumberToObject(json, "throttle_temperature", snapshot->get_int(THERMAL_GOVERNOR_THROTTLE_TEMPERATURE_SYSTEM_PROPERTY_KEY) >= 0 ? snapshot->get_int(THERMAL_GOVERNOR_THROTTLE_TEMPERATURE_SYSTEM_PROPERTY_KEY) : DEFAULT_THERMAL_GOVERNOR_THROTTLE_TEMPERATURE);
+  cJSON_AddNumberToObject(json, "restore_temperature", snapshot->get_int(THERMAL_GOVERNOR_RESTORE_TEMPERATURE_SYSTEM_PROPERTY_KEY) >= 0 ? snapshot->get_int(THERMAL_GOVERNOR_RESTORE_TEMPERATURE_SYSTEM_PROPERTY_KEY) : DEFAULT_THERMAL_GOVERNOR_RESTORE_TEMPERATURE);
+  cJSON_AddNumberToObject(json, "temperature", state.temperature);
+  cJSON_AddNumberToObject(json, "level", state.level);
+  cJSON_AddNumberToObject(json, "max_level", THERMAL_GOVERNOR_MAX_LEVEL);
+  cJSON_AddNumberToObject(json, "user_quality", state.user_quality);
+  cJSON_AddNumberToObject(json, "user_refresh_rate", state.user_refresh_rate);
+  cJSON_AddNumberToObject(json, "quality", thermal_governor_quality(state.user_quality, state.level));
+  cJSON_AddNumberToObject(json, "refresh_rate", thermal_governor_refresh_rate(state.user_refresh_rate, state.level));
+
+  cJSON* decisions = cJSON_AddArrayToObject(json, "decisions");
+  for (const ThermalGovernorDecision& decision : state.decisions) {
+    cJSON* decision_json = cJSON_CreateObject();
+    cJSON_AddNumberToObject(decision_json, "age_ms", now_ms - decision.timestamp_ms);
+    cJSON_AddNumberToObject(decision_json, "temperature", decision.temperature);
+    cJSON_AddNumberToObject(decision_json, "from_level", decision.from_level);
+    cJSON_AddNumberToObject(decision_json, "to_level", decision.to_level);
+    cJSON_AddItemToArray(decisions, decision_json);
+  }
+  return json;
 }
 
+// The benchmarks compile this file into their own binary and provide their own main().
+#ifndef TESLA_ANDROID_CONFIGURATION_MANAGER_NO_MAIN
 int main() {
   httplib::Server server;
 
+  load_device_facts();
+  start_network_interface_tracker();
+  start_usb_device_tracker();
+  start_thermal_sampler();
+  start_system_telemetry_sampler();
+  start_device_sampler();
+
   start_softap_if_enabled();
 
-  set_initial_display_resolution();
+  restore_thermal_governor_user_values();
+  start_display_job_worker();
+  start_display_reconciler();
+  start_thermal_governor();
 
   server.Get("/api/openUpdater", [](const httplib::Request& req, httplib::Response& res) {
-    system("am start -a android.settings.SYSTEM_UPDATE_SETTINGS");
+    run_logged_process({"am", "start", "-a", "android.settings.SYSTEM_UPDATE_SETTINGS"});
     res.status = 200;
   });
 
@@ -357,17 +2641,33 @@ int main() {
 
   server.Get("/api/deviceInfo", [](const httplib::Request& req, httplib::Response& res) {
     cJSON* json = cJSON_CreateObject();
+    FieldSelector selector = parse_field_selector(req);
 
-    int modem_status = (is_port_open("192.168.1.1", 80) || is_port_open("192.168.8.1", 80)) && (does_interface_exist("eth1") || does_interface_exist("eth2"));
-    int carplay_status = is_usb_device_present("1314", "1520") || is_usb_device_present("1314", "1521");
+    DeviceState state = get_device_state();
 
-    add_number_property(json, "cpu_temperature", get_cpu_temperature(), res);
-    add_string_property(json, "serial_number", get_serial_number(), res);
-    add_string_property(json, "device_model", get_system_property("ro.product.model"), res);
-    add_number_property(json, "is_modem_detected", modem_status, res);
-    add_number_property(json, "is_carplay_detected", carplay_status, res);
-    add_string_property(json, "release_type", get_system_property(RELEASE_TYPE_SYSTEM_PROPERTY_KEY), res);
-    add_string_property(json, "ota_url", get_system_property(OTA_URL_SYSTEM_PROPERTY_KEY), res);
+    if (selector.includes("cpu_temperature")) {
+      add_number_property(json, "cpu_temperature", state.values[DEVICE_PROBE_CPU_TEMPERATURE], res);
+    }
+    add_device_facts(json, selector);
+    for (size_t i = DEVICE_PROBE_CPU_TEMPERATURE + 1; i < state.count; i++) {
+      if (selector.includes(device_probes[i].field.c_str())) {
+        add_number_property(json, device_probes[i].field.c_str(), state.values[i], res);
+      }
+    }
+    if (selector.includes("release_type")) {
+      add_string_property(json, "release_type", get_system_property(RELEASE_TYPE_SYSTEM_PROPERTY_KEY), res);
+    }
+    if (selector.includes("ota_url")) {
+      add_string_property(json, "ota_url", get_system_property(OTA_URL_SYSTEM_PROPERTY_KEY), res);
+    }
+    // Ages are reported for the selected probe fields only.
+    cJSON* field_age_ms = cJSON_CreateObject();
+    add_device_state_ages(field_age_ms, state, res, selector);
+    if (field_age_ms->child != NULL) {
+      cJSON_AddItemToObject(json, "field_age_ms", field_age_ms);
+    } else {
+      cJSON_Delete(field_age_ms);
+    }
 
     char* json_str = cJSON_Print(json);
 
@@ -383,28 +2683,37 @@ int main() {
     handle_preflight(res);
   });
 
-  server.Get("/api/health", [](const httplib::Request& req, httplib::Response& res) {
+  server.Get("/api/systemTelemetry", [](const httplib::Request& req, httplib::Response& res) {
+    cJSON* json = create_system_telemetry();
+    if (json == nullptr) {
+      res.status = 503;
+      res.set_content("Service Unavailable", "text/plain");
+      return;
+    }
+
+    char* json_str = cJSON_Print(json);
+
+    res.set_header("Content-Type", "application/json");
+    res.set_content(json_str, "application/json");
     res.status = 200;
+
+    cJSON_Delete(json);
+    free(json_str);
   });
 
-  server.Options("/api/health", [](const httplib::Request& req, httplib::Response& res) {
+  server.Options("/api/systemTelemetry", [](const httplib::Request& req, httplib::Response& res) {
     handle_preflight(res);
   });
 
-  server.Get("/api/configuration", [](const httplib::Request& req, httplib::Response& res) {
-    cJSON* json = cJSON_CreateObject();
+  server.Get("/api/thermalHistory", [](const httplib::Request& req, httplib::Response& res) {
+    int seconds = req.has_param("seconds") ? atoi(req.get_param_value("seconds").c_str()) : 600;
+    int buckets = req.has_param("buckets") ? atoi(req.get_param_value("buckets").c_str()) : 60;
+    seconds = std::min(std::max(seconds, 1), 86400);
+    buckets = std::min(std::max(buckets, 1), 600);
 
-    add_number_property(json, BAND_TYPE_SYSTEM_PROPERTY_KEY, get_system_property_int(BAND_TYPE_SYSTEM_PROPERTY_KEY), res);
-    add_number_property(json, CHANNEL_SYSTEM_PROPERTY_KEY, get_system_property_int(CHANNEL_SYSTEM_PROPERTY_KEY), res);
-    add_number_property(json, CHANNEL_WIDTH_SYSTEM_PROPERTY_KEY, get_system_property_int(CHANNEL_WIDTH_SYSTEM_PROPERTY_KEY), res);
-    add_number_property(json, IS_ENABLED_SYSTEM_PROPERTY_KEY, get_system_property_int(IS_ENABLED_SYSTEM_PROPERTY_KEY), res);
-    add_number_property(json, OFFLINE_MODE_IS_ENABLED_SYSTEM_PROPERTY_KEY, get_system_property_int(OFFLINE_MODE_IS_ENABLED_SYSTEM_PROPERTY_KEY), res);
-    add_number_property(json, OFFLINE_MODE_TELEMETRY_IS_ENABLED_SYSTEM_PROPERTY_KEY, get_system_property_int(OFFLINE_MODE_TELEMETRY_IS_ENABLED_SYSTEM_PROPERTY_KEY), res);
-    add_number_property(json, OFFLINE_MODE_TESLA_FIRMWARE_DOWNLOADS_IS_ENABLED_SYSTEM_PROPERTY_KEY, get_system_property_int(OFFLINE_MODE_TESLA_FIRMWARE_DOWNLOADS_IS_ENABLED_SYSTEM_PROPERTY_KEY), res);
-    add_number_property(json, BROWSER_AUDIO_IS_ENABLED_SYSTEM_PROPERTY_KEY, get_system_property_int(BROWSER_AUDIO_IS_ENABLED_SYSTEM_PROPERTY_KEY), res);
-    add_number_property(json, BROWSER_AUDIO_VOLUME_SYSTEM_PROPERTY_KEY, get_system_property_int(BROWSER_AUDIO_VOLUME_SYSTEM_PROPERTY_KEY), res);
-    add_number_property(json, GPS_IS_ENABLED_SYSTEM_PROPERTY_KEY, get_system_property_int(GPS_IS_ENABLED_SYSTEM_PROPERTY_KEY), res);
-    add_number_property(json, GPS_HARDWARE_IS_DETECTED_SYSTEM_PROPERTY_KEY, get_system_property_int(GPS_HARDWARE_IS_DETECTED_SYSTEM_PROPERTY_KEY), res);
+    cJSON* json = cJSON_CreateObject();
+    cJSON_AddNumberToObject(json, "bucket_ms", std::max(seconds * 1000 / buckets, 1));
+    cJSON_AddItemToObject(json, "zones", create_thermal_history(seconds * 1000, buckets));
 
     char* json_str = cJSON_Print(json);
 
@@ -416,193 +2725,205 @@ int main() {
     free(json_str);
   });
 
-  server.Options("/api/configuration", [](const httplib::Request& req, httplib::Response& res) {
+  server.Options("/api/thermalHistory", [](const httplib::Request& req, httplib::Response& res) {
     handle_preflight(res);
   });
 
-  server.Post("/api/overrideReleaseType", [](const httplib::Request& req, httplib::Response& res) {
-    const char* new_value = req.body.c_str();
-    int result = property_set(RELEASE_TYPE_SYSTEM_PROPERTY_KEY, new_value);
-    if (result == 0) {
-        handle_post_success(res);
-    } else {
-        handle_error(res);
-    }
-  });
+  server.Get("/api/thermalGovernor", [](const httplib::Request& req, httplib::Response& res) {
+    cJSON* json = create_thermal_governor_state();
 
-  server.Options("/api/overrideReleaseType", [](const httplib::Request& req, httplib::Response& res) {
-    handle_preflight(res);
-  });
+    char* json_str = cJSON_Print(json);
 
-  server.Post("/api/overrideOtaUrl", [](const httplib::Request& req, httplib::Response& res) {
-    const char* new_value = req.body.c_str();
-    int result = property_set(OTA_URL_SYSTEM_PROPERTY_KEY, new_value);
-    if (result == 0) {
-        handle_post_success(res);
-    } else {
-        handle_error(res);
-    }
+    res.set_header("Content-Type", "application/json");
+    res.set_content(json_str, "application/json");
+    res.status = 200;
+
+    cJSON_Delete(json);
+    free(json_str);
   });
 
-  server.Options("/api/overrideOtaUrl", [](const httplib::Request& req, httplib::Response& res) {
+  server.Options("/api/thermalGovernor", [](const httplib::Request& req, httplib::Response& res) {
     handle_preflight(res);
   });
 
-  server.Post("/api/gpsState", [](const httplib::Request& req, httplib::Response& res) {
-    const char* new_value = req.body.c_str();
-    int result = property_set(GPS_IS_ENABLED_SYSTEM_PROPERTY_KEY, new_value);
-    if (result == 0) {
-        handle_post_success(res);
-    } else {
-        handle_error(res);
-    }
+  server.Get("/api/health", [](const httplib::Request& req, httplib::Response& res) {
+    res.status = 200;
   });
 
-  server.Options("/api/gpsState", [](const httplib::Request& req, httplib::Response& res) {
+  server.Options("/api/health", [](const httplib::Request& req, httplib::Response& res) {
     handle_preflight(res);
   });
 
-  server.Post("/api/browserAudioState", [](const httplib::Request& req, httplib::Response& res) {
-    const char* new_value = req.body.c_str();
-    int result = property_set(BROWSER_AUDIO_IS_ENABLED_SYSTEM_PROPERTY_KEY, new_value);
-    if (result == 0) {
-        handle_post_success(res);
-    } else {
-        handle_error(res);
-    }
-  });
+  server.Get("/api/propertyWriteStats", [](const httplib::Request& req, httplib::Response& res) {
+    cJSON* json = cJSON_CreateObject();
 
-  server.Options("/api/browserAudioState", [](const httplib::Request& req, httplib::Response& res) {
-    handle_preflight(res);
-  });
+    add_number_property(json, "applied", property_writes_applied.load(std::memory_order_relaxed), res);
+    add_number_property(json, "skipped", property_writes_skipped.load(std::memory_order_relaxed), res);
 
-  server.Post("/api/browserAudioVolume", [](const httplib::Request& req, httplib::Response& res) {
-    const char* new_value = req.body.c_str();
-    int result = property_set(BROWSER_AUDIO_VOLUME_SYSTEM_PROPERTY_KEY, new_value);
-    if (result == 0) {
-        handle_post_success(res);
-    } else {
-        handle_error(res);
-    }
-  });
+    char* json_str = cJSON_Print(json);
 
-  server.Options("/api/browserAudioVolume", [](const httplib::Request& req, httplib::Response& res) {
-    handle_preflight(res);
-  });
+    res.set_header("Content-Type", "application/json");
+    res.set_content(json_str, "application/json");
+    res.status = 200;
 
-  server.Post("/api/softApBand", [](const httplib::Request& req, httplib::Response& res) {
-    const char* new_value = req.body.c_str();
-    int result = property_set(BAND_TYPE_SYSTEM_PROPERTY_KEY, new_value);
-    if (result == 0) {
-        handle_post_success(res);
-    } else {
-        handle_error(res);
-    }
+    cJSON_Delete(json);
+    free(json_str);
   });
 
-  server.Options("/api/softApBand", [](const httplib::Request& req, httplib::Response& res) {
+  server.Options("/api/propertyWriteStats", [](const httplib::Request& req, httplib::Response& res) {
     handle_preflight(res);
   });
 
-  server.Post("/api/softApChannel", [](const httplib::Request& req, httplib::Response& res) {
-    const char* new_value = req.body.c_str();
-    int result = property_set(CHANNEL_SYSTEM_PROPERTY_KEY, new_value);
-    if (result == 0) {
-        handle_post_success(res);
-    } else {
-        handle_error(res);
+  server.Get("/api/events", [](const httplib::Request& req, httplib::Response& res) {
+    std::shared_ptr<LongPollSlot> slot = acquire_long_poll_slot();
+    if (slot == nullptr) {
+      handle_service_unavailable(res);
+      return;
     }
+
+    std::shared_ptr<EventStream> stream = std::make_shared<EventStream>();
+    res.set_header("Cache-Control", "no-cache");
+    // The provider owns the slot, so it is released when the stream ends.
+    res.set_chunked_content_provider("text/event-stream", [slot, stream, &res](size_t offset, httplib::DataSink& sink) {
+      return write_next_event(*stream, sink, res);
+    });
   });
 
-  server.Options("/api/softApChannel", [](const httplib::Request& req, httplib::Response& res) {
+  server.Options("/api/events", [](const httplib::Request& req, httplib::Response& res) {
     handle_preflight(res);
   });
 
-  server.Post("/api/softApChannelWidth", [](const httplib::Request& req, httplib::Response& res) {
-    const char* new_value = req.body.c_str();
-    int result = property_set(CHANNEL_WIDTH_SYSTEM_PROPERTY_KEY, new_value);
-    if (result == 0) {
-        handle_post_success(res);
-    } else {
-        handle_error(res);
+  server.Get("/api/watch", [](const httplib::Request& req, httplib::Response& res) {
+    uint64_t known_version = req.has_param("version") ? strtoull(req.get_param_value("version").c_str(), nullptr, 10) : 0;
+    int timeout_ms = req.has_param("timeout") ? atoi(req.get_param_value("timeout").c_str()) : 25000;
+    timeout_ms = std::min(std::max(timeout_ms, 0), 60000);
+
+    std::shared_ptr<LongPollSlot> slot = acquire_long_poll_slot();
+    if (slot == nullptr) {
+      handle_service_unavailable(res);
+      return;
+    }
+
+    std::shared_ptr<const PropertySnapshot> snapshot = wait_for_property_snapshot(known_version, timeout_ms);
+    if (snapshot->version == known_version) {
+      res.status = 304;
+      return;
     }
+
+    cJSON* json = cJSON_CreateObject();
+    cJSON_AddNumberToObject(json, "version", snapshot->version);
+    add_configuration_properties(cJSON_AddObjectToObject(json, "configuration"), *snapshot, res);
+    add_display_state_properties(cJSON_AddObjectToObject(json, "displayState"), *snapshot, res);
+
+    char* json_str = cJSON_Print(json);
+
+    res.set_header("Content-Type", "application/json");
+    res.set_content(json_str, "application/json");
+    res.status = 200;
+
+    cJSON_Delete(json);
+    free(json_str);
   });
 
-  server.Options("/api/softApChannelWidth", [](const httplib::Request& req, httplib::Response& res) {
+  server.Options("/api/watch", [](const httplib::Request& req, httplib::Response& res) {
     handle_preflight(res);
   });
 
-  server.Post("/api/softApState", [](const httplib::Request& req, httplib::Response& res) {
-    const char* new_value = req.body.c_str();
-    int result = property_set(IS_ENABLED_SYSTEM_PROPERTY_KEY, new_value);
-    if (result == 0) {
-        handle_post_success(res);
-    } else {
-        handle_error(res);
-    }
-  });
+  server.Get("/api/configuration", [](const httplib::Request& req, httplib::Response& res) {
+    cJSON* json = cJSON_CreateObject();
+    std::shared_ptr<const PropertySnapshot> snapshot = get_property_snapshot();
+    add_configuration_properties(json, *snapshot, res, parse_field_selector(req));
 
-  server.Options("/api/softApState", [](const httplib::Request& req, httplib::Response& res) {
-    handle_preflight(res);
+    char* json_str = cJSON_Print(json);
+
+    res.set_header("Content-Type", "application/json");
+    res.set_content(json_str, "application/json");
+    res.status = 200;
+
+    cJSON_Delete(json);
+    free(json_str);
   });
 
-  server.Post("/api/offlineModeState", [](const httplib::Request& req, httplib::Response& res) {
-    const char* new_value = req.body.c_str();
-    int result = property_set(OFFLINE_MODE_IS_ENABLED_SYSTEM_PROPERTY_KEY, new_value);
-    if (result == 0) {
-        handle_post_success(res);
-    } else {
-        handle_error(res);
+  server.Patch("/api/configuration", [](const httplib::Request& req, httplib::Response& res) {
+    cJSON* json = cJSON_Parse(req.body.c_str());
+    if (!cJSON_IsObject(json)) {
+        handle_bad_request(res);
+        cJSON_Delete(json);
+        return;
     }
-  });
 
-  server.Options("/api/offlineModeState", [](const httplib::Request& req, httplib::Response& res) {
-    handle_preflight(res);
-  });
+    PropertyWriteBatch batch;
+    cJSON* results = cJSON_CreateObject();
+    bool is_valid = true;
+    bool has_display_setting = false;
+    cJSON* item;
+    cJSON_ArrayForEach(item, json) {
+      const PropertySchema* schema = find_writable_property_schema(item->string);
+      std::string new_value;
+      if (schema == nullptr) {
+        cJSON_AddStringToObject(results, item->string, "unknown");
+        is_valid = false;
+      } else if (!(cJSON_IsNumber(item) && normalize_property_value(*schema, std::to_string(item->valueint).c_str(), new_value)) &&
+                 !(cJSON_IsString(item) && normalize_property_value(*schema, item->valuestring, new_value))) {
+        cJSON_AddStringToObject(results, item->string, "invalid");
+        is_valid = false;
+      } else {
+        cJSON_AddStringToObject(results, item->string, "ok");
+        batch.set(schema->key, new_value);
+        has_display_setting |= schema->is_display_setting;
+      }
+    }
 
-  server.Post("/api/offlineModeTelemetryState", [](const httplib::Request& req, httplib::Response& res) {
-    const char* new_value = req.body.c_str();
-    int result = property_set(OFFLINE_MODE_TELEMETRY_IS_ENABLED_SYSTEM_PROPERTY_KEY, new_value);
-    if (result == 0) {
-        handle_post_success(res);
+    if (!is_valid) {
+      // Nothing is written when any key is rejected.
+      cJSON* result;
+      cJSON_ArrayForEach(result, results) {
+        if (strcmp(result->valuestring, "ok") == 0) cJSON_SetValuestring(result, "skipped");
+      }
+      res.status = 400;
+    } else if (batch.commit()) {
+      res.status = 200;
+      // The reconfiguration runs in the background, like POST /api/displayState.
+      if (has_display_setting) {
+        add_display_job_reference(results, *configure_virtual_display_from_properties(), res);
+        res.status = 202;
+      }
     } else {
-        handle_error(res);
+      cJSON* result;
+      cJSON_ArrayForEach(result, results) {
+        cJSON_SetValuestring(result, "failed");
+      }
+      res.status = 500;
     }
+
+    char* json_str = cJSON_Print(results);
+    res.set_content(json_str, "application/json");
+
+    cJSON_Delete(json);
+    cJSON_Delete(results);
+    free(json_str);
   });
 
-  server.Options("/api/offlineModeTelemetryState", [](const httplib::Request& req, httplib::Response& res) {
+  server.Options("/api/configuration", [](const httplib::Request& req, httplib::Response& res) {
     handle_preflight(res);
   });
 
-  server.Post("/api/offlineModeTeslaFirmwareDownloads", [](const httplib::Request& req, httplib::Response& res) {
-    const char* new_value = req.body.c_str();
-    int result = property_set(OFFLINE_MODE_TESLA_FIRMWARE_DOWNLOADS_IS_ENABLED_SYSTEM_PROPERTY_KEY, new_value);
-    if (result == 0) {
-        handle_post_success(res);
-    } else {
-        handle_error(res);
-    }
-  });
+  for (const PropertySchema& schema : PROPERTY_SCHEMA) {
+    if (schema.route == nullptr) continue;
 
-  server.Options("/api/offlineModeTeslaFirmwareDownloads", [](const httplib::Request& req, httplib::Response& res) {
-    handle_preflight(res);
-   });
+    server.Post(schema.route, [&schema](const httplib::Request& req, httplib::Response& res) {
+      handle_property_post(schema, req, res);
+    });
+
+    server.Options(schema.route, [](const httplib::Request& req, httplib::Response& res) {
+      handle_preflight(res);
+    });
+  }
 
   server.Get("/api/displayState", [](const httplib::Request& req, httplib::Response& res) {
     cJSON* json = cJSON_CreateObject();
-
-    add_number_property(json, "width", get_system_property_int(VIRTUAL_DISPLAY_RESOLUTION_WIDTH_SYSTEM_PROPERTY_KEY), res);
-    add_number_property(json, "height", get_system_property_int(VIRTUAL_DISPLAY_RESOLUTION_HEIGHT_SYSTEM_PROPERTY_KEY), res);
-    add_number_property(json, "density", get_system_property_int(VIRTUAL_DISPLAY_DENSITY_SYSTEM_PROPERTY_KEY), res);
-    add_number_property(json, "refreshRate", get_system_property_int(VIRTUAL_DISPLAY_REFRESH_RATE_SYSTEM_PROPERTY_KEY), res);
-    add_number_property(json, "quality", get_system_property_int(VIRTUAL_DISPLAY_QUALITY_SYSTEM_PROPERTY_KEY), res);
-    add_number_property(json, "resolutionPreset", get_system_property_int(VIRTUAL_DISPLAY_RESOLUTION_PRESET_SYSTEM_PROPERTY_KEY), res);
-    add_number_property(json, "renderer", get_system_property_int(VIRTUAL_DISPLAY_RENDERER_SYSTEM_PROPERTY_KEY), res);
-    add_number_property(json, "isResponsive", get_system_property_int(VIRTUAL_DISPLAY_IS_RESPONSIVE_SYSTEM_PROPERTY_KEY), res);
-    add_number_property(json, "isH264", get_system_property_int(VIRTUAL_DISPLAY_IS_H264_SYSTEM_PROPERTY_KEY), res);
-    add_number_property(json, "isHeadless", get_system_property_int(HEADLESS_CONFIG_IS_ENABLED_PROPERTY_KEY), res);
-    add_number_property(json, "isRearDisplayEnabled", get_system_property_int(VIRTUAL_DISPLAY_IS_REAR_DISPLAY_ENABLED_SYSTEM_PROPERTY_KEY), res);
-	add_number_property(json, "isRearDisplayPrioritised", get_system_property_int(VIRTUAL_DISPLAY_IS_REAR_DISPLAY_PRIORITISED_SYSTEM_PROPERTY_KEY), res);
+    std::shared_ptr<const PropertySnapshot> snapshot = get_property_snapshot();
+    add_display_state_properties(json, *snapshot, res, parse_field_selector(req));
 
     char* json_str = cJSON_Print(json);
 
@@ -626,39 +2947,22 @@ int main() {
         return;
     }
 
-    cJSON* width = cJSON_GetObjectItemCaseSensitive(json, "width");
-    cJSON* height = cJSON_GetObjectItemCaseSensitive(json, "height");
-    cJSON* density = cJSON_GetObjectItemCaseSensitive(json, "density");
-    cJSON* resolutionPreset = cJSON_GetObjectItemCaseSensitive(json, "resolutionPreset");
-    cJSON* renderer = cJSON_GetObjectItemCaseSensitive(json, "renderer");
-    cJSON* isResponsive = cJSON_GetObjectItemCaseSensitive(json, "isResponsive");
-    cJSON* isH264 = cJSON_GetObjectItemCaseSensitive(json, "isH264");
-    cJSON* refreshRate = cJSON_GetObjectItemCaseSensitive(json, "refreshRate");
-    cJSON* quality = cJSON_GetObjectItemCaseSensitive(json, "quality");
-    cJSON* isRearDisplayEnabled = cJSON_GetObjectItemCaseSensitive(json, "isRearDisplayEnabled");
-    cJSON* isRearDisplayPrioritised = cJSON_GetObjectItemCaseSensitive(json, "isRearDisplayPrioritised");
+    PropertyWriteBatch batch;
+    for (const PropertySchema& schema : PROPERTY_SCHEMA) {
+      if (!schema.is_display_setting) continue;
 
-    if (!cJSON_IsNumber(width) || !cJSON_IsNumber(height) || !cJSON_IsNumber(density) || !cJSON_IsNumber(resolutionPreset) || !cJSON_IsNumber(renderer) || !cJSON_IsNumber(isResponsive) || !cJSON_IsNumber(isH264) || !cJSON_IsNumber(refreshRate) || !cJSON_IsNumber(quality) || !cJSON_IsNumber(isRearDisplayEnabled) || !cJSON_IsNumber(isRearDisplayPrioritised)) {
-        handle_error(res);
+      cJSON* item = cJSON_GetObjectItemCaseSensitive(json, schema.field);
+      std::string new_value;
+      if (!cJSON_IsNumber(item) || !normalize_property_value(schema, std::to_string(item->valueint).c_str(), new_value)) {
+        handle_bad_request(res);
         cJSON_Delete(json);
         return;
+      }
+      batch.set(schema.key, new_value);
     }
 
-    int widthSetPropertyResult = property_set(VIRTUAL_DISPLAY_RESOLUTION_WIDTH_SYSTEM_PROPERTY_KEY, std::to_string(width->valueint).c_str());
-    int heightSetPropertyResult = property_set(VIRTUAL_DISPLAY_RESOLUTION_HEIGHT_SYSTEM_PROPERTY_KEY, std::to_string(height->valueint).c_str());
-    int densitySetPropertyResult = property_set(VIRTUAL_DISPLAY_DENSITY_SYSTEM_PROPERTY_KEY, std::to_string(density->valueint).c_str());
-    int resolutionPresetSetPropertyResult = property_set(VIRTUAL_DISPLAY_RESOLUTION_PRESET_SYSTEM_PROPERTY_KEY, std::to_string(resolutionPreset->valueint).c_str());
-    int rendererSetPropertyResult = property_set(VIRTUAL_DISPLAY_RENDERER_SYSTEM_PROPERTY_KEY, std::to_string(renderer->valueint).c_str());
-    int isResponsiveSetPropertyResult = property_set(VIRTUAL_DISPLAY_IS_RESPONSIVE_SYSTEM_PROPERTY_KEY, std::to_string(isResponsive->valueint).c_str());
-    int isH264SetPropertyResult = property_set(VIRTUAL_DISPLAY_IS_H264_SYSTEM_PROPERTY_KEY, std::to_string(isH264->valueint).c_str());
-    int refreshRateSetPropertyResult = property_set(VIRTUAL_DISPLAY_REFRESH_RATE_SYSTEM_PROPERTY_KEY, std::to_string(refreshRate->valueint).c_str());
-    int qualitySetPropertyResult = property_set(VIRTUAL_DISPLAY_QUALITY_SYSTEM_PROPERTY_KEY, std::to_string(quality->valueint).c_str());
-    int isRearDisplayEnabledSetPropertyResult = property_set(VIRTUAL_DISPLAY_IS_REAR_DISPLAY_ENABLED_SYSTEM_PROPERTY_KEY, std::to_string(isRearDisplayEnabled->valueint).c_str());
-    int isRearDisplayPrioritisedSetPropertyResult = property_set(VIRTUAL_DISPLAY_IS_REAR_DISPLAY_PRIORITISED_SYSTEM_PROPERTY_KEY, std::to_string(isRearDisplayPrioritised->valueint).c_str());
-
-    if (widthSetPropertyResult == 0 && heightSetPropertyResult == 0 && densitySetPropertyResult == 0 && resolutionPresetSetPropertyResult == 0 && rendererSetPropertyResult == 0 && isResponsiveSetPropertyResult == 0 && isH264SetPropertyResult == 0 && refreshRateSetPropertyResult == 0 && qualitySetPropertyResult == 0 && isRearDisplayEnabledSetPropertyResult == 0 && isRearDisplayPrioritisedSetPropertyResult == 0) {
-        handle_post_success(res);
-        configure_virtual_display(width->valueint, height->valueint, density->valueint, refreshRate->valueint);
+    if (batch.commit()) {
+        handle_display_job_accepted(*configure_virtual_display_from_properties(), res);
     } else {
         handle_error(res);
     }
@@ -670,13 +2974,66 @@ int main() {
     handle_preflight(res);
   });
 
+  server.Get("/api/displayReconciler", [](const httplib::Request& req, httplib::Response& res) {
+    cJSON* json = create_display_reconciler_state();
+
+    char* json_str = cJSON_Print(json);
+
+    res.set_header("Content-Type", "application/json");
+    res.set_content(json_str, "application/json");
+    res.status = 200;
+
+    cJSON_Delete(json);
+    free(json_str);
+  });
+
+  server.Options("/api/displayReconciler", [](const httplib::Request& req, httplib::Response& res) {
+    handle_preflight(res);
+  });
+
+  server.Get("/api/displayJobs", [](const httplib::Request& req, httplib::Response& res) {
+    cJSON* json = create_display_job_history();
+
+    char* json_str = cJSON_Print(json);
+
+    res.set_header("Content-Type", "application/json");
+    res.set_content(json_str, "application/json");
+    res.status = 200;
+
+    cJSON_Delete(json);
+    free(json_str);
+  });
+
+  server.Get(R"(/api/displayJobs/(\d+))", [](const httplib::Request& req, httplib::Response& res) {
+    cJSON* json = create_display_job_status(strtoull(req.matches[1].str().c_str(), nullptr, 10));
+    if (json == nullptr) {
+      res.status = 404;
+      res.set_content("Not Found", "text/plain");
+      return;
+    }
+
+    char* json_str = cJSON_Print(json);
+
+    res.set_header("Content-Type", "application/json");
+    res.set_content(json_str, "application/json");
+    res.status = 200;
+
+    cJSON_Delete(json);
+    free(json_str);
+  });
+
+  server.Options(R"(/api/displayJobs(/\d+)?)", [](const httplib::Request& req, httplib::Response& res) {
+    handle_preflight(res);
+  });
+
   server.set_post_routing_handler([](const auto& req, auto& res) {
-    res.set_header("Allow", "GET, POST, HEAD, OPTIONS");
+    res.set_header("Allow", "GET, POST, PATCH, HEAD, OPTIONS");
     res.set_header("Access-Control-Allow-Origin", "*");
     res.set_header("Access-Control-Allow-Headers", "X-Requested-With, Content-Type, Accept, Origin, Authorization");
-    res.set_header("Access-Control-Allow-Methods", "OPTIONS, GET, POST, HEAD");
+    res.set_header("Access-Control-Allow-Methods", "OPTIONS, GET, POST, PATCH, HEAD");
   });
 
   server.listen("0.0.0.0", 8081);
   return 0;
 }
+#endif